@@ -4,6 +4,7 @@ Licensed under the MIT License. See LICENSE file for details.
 */
 
 #include "esp_wifi_interface.h"
+#include "esp_wifi_ip_watchdog.h"
 
 #include "esp_log.h"
 #include <stdint.h>
@@ -11,6 +12,10 @@ Licensed under the MIT License. See LICENSE file for details.
 #include <stdio.h>
 
 #include "esp_system.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
 #include "nvs_flash.h"
 
 #include "esp_event.h"
@@ -24,6 +29,8 @@ Licensed under the MIT License. See LICENSE file for details.
 
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#include "ping/ping_sock.h"
+#include "lwip/sockets.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -45,6 +52,20 @@ Licensed under the MIT License. See LICENSE file for details.
 #define EXAMPLE_H2E_IDENTIFIER "" // CONFIG_ESP_WIFI_PW_ID
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
+#define WIFI_NVS_READY_BIT BIT2   // NVS flash initialized, esp_wifi_init may run
+#define WIFI_STACK_READY_BIT BIT3 // netif, event loop and Wi-Fi driver initialized
+#define WIFI_ASSOCIATED_BIT BIT4  // STA associated with the AP, with or without IP
+#define WIFI_PROBE_OK_BIT BIT5    // gateway answered the last watchdog probe
+#define WIFI_PROBE_DONE_BIT BIT6  // last watchdog probe finished
+#define WIFI_BOOT_TASK_STACK (4096)
+#define WIFI_RTC_CACHE_MAGIC (0x57494649) // "WIFI"
+#define WIFI_WATCHDOG_TASK_STACK (3072)
+#define WIFI_WATCHDOG_PROBE_TIMEOUT_MS (1000)
+#define WIFI_WATCHDOG_DEFAULT_FAILURES (3)
+#define WIFI_AP_DEFAULT_MAX_CONNECTION MIN(4, ESP_WIFI_MAX_CONN_NUM) // ESP_WIFI_MAX_CONN_NUM depends on the target
+#define WIFI_AP_SWEEP_PERIOD_US (1000 * 1000)
+#define WIFI_AP_EVICTED_MAX (8) // evicted stations remembered for the cooldown
+#define WIFI_AP_EVICT_COOLDOWN_US (5 * 60 * 1000 * 1000LL) // evicted stations are refused for this long
 
 typedef enum
 {
@@ -52,6 +73,16 @@ typedef enum
     ap
 } wifi_typemode_t;
 
+// Static IPv4 configuration stored in NVS, applied instead of DHCP
+typedef struct
+{
+    bool enabled;
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+    esp_ip4_addr_t dns;
+} wifi_static_ip_t;
+
 typedef struct esp_wifi_interface_t esp_wifi_interface_t;
 
 struct esp_wifi_interface_t
@@ -61,7 +92,8 @@ struct esp_wifi_interface_t
     uint8_t channel;                          // channel of the access point
     wifi_typemode_t wifi_mode;                // mode of the access point
     esp_nvs_handle_t nvs_handle;              // NVS handle
-    char local_ip[16];                        // local IP address
+    char local_ip[2][16];                     // local IP address, double buffered, see state_set_local_ip
+    uint8_t local_ip_index;                   // buffer of local_ip returned by WiFiGetLocalIP
     httpd_handle_t server;                    // Handle off the web server
     uint8_t esp_max_retry;                    // maximum number of retries to connect to the AP
     uint8_t s_retry_num;                      // Number of attempts to connect to the AP
@@ -69,11 +101,672 @@ struct esp_wifi_interface_t
     uint8_t esp_wifi_scan_auth_mode_treshold; // Authentication mode threshold for Wi-Fi scan
     gpio_num_t status_io;
     gpio_num_t reset_io;
+    bool fast_connect;                        // connecting straight to the cached BSSID/channel
+    esp_netif_t *netif;                       // STA or AP network interface
+    uint32_t ip_watchdog_interval_ms;         // minimum gateway probe interval, 0 disables the watchdog
+    uint32_t ip_watchdog_max_interval_ms;     // maximum gateway probe interval
+    uint8_t ip_watchdog_max_failures;         // failed probes before recovering the link
+    wifi_static_ip_t static_ip;               // static IPv4 configuration, DHCP when disabled
+    bool ipv6;                                // enable IPv6 link-local and SLAAC
+    // the three addresses below are written between state_write_begin/end, see WiFiGetLocalIPInfo
+    esp_netif_ip_info_t ip_info;              // IPv4 address, netmask and gateway in use
+    esp_ip6_addr_t ip6_link_local;            // IPv6 link-local address
+    esp_ip6_addr_t ip6_global;                // IPv6 address obtained by SLAAC
+    bool power_save_set;                      // power_save stored in NVS, driver default otherwise
+    wifi_ps_type_t power_save;                // STA power save mode
+    uint8_t ap_max_connection;                // maximum stations on the provisioning AP
+    uint32_t ap_idle_timeout_ms;              // idle station eviction timeout, 0 disables it
 };
 
+typedef struct
+{
+    bool used;
+    esp_wifi_interface_ap_station_t info;
+} wifi_ap_station_slot_t;
+
+typedef struct
+{
+    uint8_t mac[6];
+    int64_t until_us; // refused until this time, 0 for an unused entry
+} wifi_ap_evicted_t;
+
+// Warm-boot cache kept in RTC slow memory, survives deep sleep but not a power cycle
+typedef struct
+{
+    uint32_t magic;
+    uint8_t ssid[32];
+    uint8_t password[64];
+    uint8_t bssid[6];   // BSSID of the last successful association
+    uint8_t ap_channel; // primary channel of the last successful association
+    bool bssid_valid;
+    wifi_static_ip_t static_ip;
+    bool ipv6;
+    uint8_t esp_max_retry;
+    bool power_save_set;
+    wifi_ps_type_t power_save;
+    uint32_t crc; // crc32 of the fields above
+} wifi_rtc_cache_t;
+
 static esp_wifi_interface_handle_t wifi_interface_handle = NULL;
 static const char *tag_wifi = "WiFi";
 static EventGroupHandle_t s_wifi_event_group; // FreeRTOS event group to signal when we are connected
+static esp_err_t s_wifi_boot_err = ESP_OK;    // result of the background stack initialization
+static int64_t s_boot_phase_time[WIFI_BOOT_PHASE_MAX];
+static RTC_DATA_ATTR wifi_rtc_cache_t s_rtc_cache;
+
+// State snapshot published with a sequence lock: the counter is odd while a writer is updating
+// s_state, readers retry until they see the same even value before and after copying it.
+// The handle addresses (ip_info, ip6_*) are published under the same counter.
+static esp_wifi_interface_state_t s_state;
+static esp_wifi_interface_state_t s_state_prev; // s_state before the current write, under s_state_lock
+static uint32_t s_state_seq;
+static portMUX_TYPE s_state_lock = portMUX_INITIALIZER_UNLOCKED; // serializes writers only
+static esp_wifi_interface_state_cb_t s_state_cb;
+static void *s_state_cb_arg;
+
+// Stations of the provisioning AP, written from the event loop and httpd tasks
+static wifi_ap_station_slot_t s_ap_stations[ESP_WIFI_MAX_CONN_NUM];
+static wifi_ap_evicted_t s_ap_evicted[WIFI_AP_EVICTED_MAX]; // oldest entry overwritten first
+static int s_ap_evicted_next;
+static portMUX_TYPE s_ap_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *boot_phase_name[WIFI_BOOT_PHASE_MAX] = {
+    "init",
+    "gpio",
+    "nvs",
+    "credentials",
+    "netif",
+    "driver",
+    "start",
+    "connected",
+    "got_ip",
+};
+
+// record the first time a boot phase is reached
+static void boot_phase_mark(esp_wifi_interface_boot_phase_t phase)
+{
+    if (s_boot_phase_time[phase] == 0)
+    {
+        s_boot_phase_time[phase] = esp_timer_get_time();
+    }
+}
+
+static esp_wifi_interface_state_t *state_write_begin()
+{
+    portENTER_CRITICAL(&s_state_lock);
+    __atomic_store_n(&s_state_seq, s_state_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s_state_prev = s_state;
+    return &s_state;
+}
+
+static void state_write_end()
+{
+    // s_state is only ever written field by field, so its padding stays zero and memcmp is exact
+    bool changed = memcmp(&s_state_prev, &s_state, sizeof(s_state)) != 0;
+    esp_wifi_interface_state_t state = s_state;
+    esp_wifi_interface_state_cb_t cb = s_state_cb;
+    void *cb_arg = s_state_cb_arg;
+    __atomic_store_n(&s_state_seq, s_state_seq + 1, __ATOMIC_RELEASE);
+    portEXIT_CRITICAL(&s_state_lock);
+
+    // called outside the critical section, the callback may log or post to a queue
+    if (cb && changed)
+    {
+        cb(&state, cb_arg);
+    }
+}
+
+// Called between state_write_begin/end. The string is written to the buffer WiFiGetLocalIP is not
+// returning and published by flipping the index, so a reader copying the string never sees it
+// half written
+static void state_set_local_ip(const esp_ip4_addr_t *ip)
+{
+    uint8_t next = !wifi_interface_handle->local_ip_index;
+    if (ip)
+    {
+        sprintf(wifi_interface_handle->local_ip[next], IPSTR, IP2STR(ip));
+    }
+    else
+    {
+        wifi_interface_handle->local_ip[next][0] = '\0';
+    }
+    __atomic_store_n(&wifi_interface_handle->local_ip_index, next, __ATOMIC_RELEASE);
+}
+
+// netif, event loop and Wi-Fi driver do not depend on the stored credentials,
+// so they are brought up in parallel with the NVS reads done by WiFiInit
+static void wifi_boot_task(void *arg)
+{
+    esp_err_t ret = esp_netif_init();
+    if (ret == ESP_OK)
+    {
+        ret = esp_event_loop_create_default();
+        if (ret == ESP_ERR_INVALID_STATE)
+        {
+            // default loop already created by the application
+            ret = ESP_OK;
+        }
+    }
+    boot_phase_mark(WIFI_BOOT_PHASE_NETIF);
+
+    // esp_wifi_init loads PHY and Wi-Fi data from NVS, wait for the flash to be initialized
+    xEventGroupWaitBits(s_wifi_event_group, WIFI_NVS_READY_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    if (ret == ESP_OK)
+    {
+        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+        ret = esp_wifi_init(&cfg);
+        boot_phase_mark(WIFI_BOOT_PHASE_DRIVER);
+    }
+
+    s_wifi_boot_err = ret;
+    xEventGroupSetBits(s_wifi_event_group, WIFI_STACK_READY_BIT);
+    vTaskDelete(NULL);
+}
+
+static uint32_t rtc_cache_crc()
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&s_rtc_cache, offsetof(wifi_rtc_cache_t, crc));
+}
+
+static bool rtc_cache_valid()
+{
+    return s_rtc_cache.magic == WIFI_RTC_CACHE_MAGIC && s_rtc_cache.crc == rtc_cache_crc();
+}
+
+static void rtc_cache_invalidate()
+{
+    memset(&s_rtc_cache, 0, sizeof(s_rtc_cache));
+}
+
+// keep the credentials loaded from NVS for the next deep-sleep wake
+static void rtc_cache_store_credentials(esp_wifi_interface_handle_t handle)
+{
+    if (!rtc_cache_valid() || memcmp(s_rtc_cache.ssid, handle->ssid, sizeof(s_rtc_cache.ssid)) != 0)
+    {
+        rtc_cache_invalidate();
+    }
+    s_rtc_cache.magic = WIFI_RTC_CACHE_MAGIC;
+    memcpy(s_rtc_cache.ssid, handle->ssid, sizeof(s_rtc_cache.ssid));
+    memcpy(s_rtc_cache.password, handle->password, sizeof(s_rtc_cache.password));
+    s_rtc_cache.static_ip = handle->static_ip;
+    s_rtc_cache.ipv6 = handle->ipv6;
+    s_rtc_cache.esp_max_retry = handle->esp_max_retry;
+    s_rtc_cache.power_save_set = handle->power_save_set;
+    s_rtc_cache.power_save = handle->power_save;
+    s_rtc_cache.crc = rtc_cache_crc();
+}
+
+static void rtc_cache_store_ap(const uint8_t *bssid, uint8_t channel)
+{
+    if (!rtc_cache_valid())
+    {
+        return;
+    }
+    memcpy(s_rtc_cache.bssid, bssid, sizeof(s_rtc_cache.bssid));
+    s_rtc_cache.ap_channel = channel;
+    s_rtc_cache.bssid_valid = true;
+    s_rtc_cache.crc = rtc_cache_crc();
+}
+
+// open the wifi namespace, skipped on warm boot until something has to be written
+static esp_err_t wifi_nvs_open(esp_wifi_interface_handle_t handle)
+{
+    if (handle->nvs_handle)
+    {
+        return ESP_OK;
+    }
+
+    esp_nvs_config_t esp_nvs_config = {
+        .name_space = "wifi_nvs",
+        .key = "SSID",
+        .value_size = 64,
+    };
+
+    return init_esp_nvs(&esp_nvs_config, &handle->nvs_handle);
+}
+
+static bool wifi_nvs_read_ip4(esp_wifi_interface_handle_t handle, const char *key, esp_ip4_addr_t *addr)
+{
+    char *value = NULL;
+    esp_nvs_change_key(key, handle->nvs_handle);
+    if (esp_nvs_read_string(handle->nvs_handle, &value) != ESP_OK || value == NULL)
+    {
+        return false;
+    }
+    return esp_netif_str_to_ip4(value, addr) == ESP_OK;
+}
+
+// static IPv4 is only used when address, netmask and gateway are all stored, DNS is optional
+static void wifi_nvs_load_static_ip(esp_wifi_interface_handle_t handle)
+{
+    wifi_static_ip_t *static_ip = &handle->static_ip;
+    memset(static_ip, 0, sizeof(*static_ip));
+
+    static_ip->enabled = wifi_nvs_read_ip4(handle, "IP", &static_ip->ip) &&
+                         wifi_nvs_read_ip4(handle, "MASK", &static_ip->netmask) &&
+                         wifi_nvs_read_ip4(handle, "GW", &static_ip->gw);
+    if (static_ip->enabled)
+    {
+        wifi_nvs_read_ip4(handle, "DNS", &static_ip->dns);
+        ESP_LOGI(tag_wifi, "Static IP " IPSTR, IP2STR(&static_ip->ip));
+    }
+
+    char *p_ipv6 = NULL;
+    esp_nvs_change_key("IPV6", handle->nvs_handle);
+    handle->ipv6 = esp_nvs_read_string(handle->nvs_handle, &p_ipv6) == ESP_OK && p_ipv6 && strcmp(p_ipv6, "1") == 0;
+}
+
+static bool wifi_nvs_read_int(esp_wifi_interface_handle_t handle, const char *key, long min, long max, long *out)
+{
+    char *value = NULL;
+    char *end = NULL;
+    esp_nvs_change_key(key, handle->nvs_handle);
+    if (esp_nvs_read_string(handle->nvs_handle, &value) != ESP_OK || value == NULL)
+    {
+        return false;
+    }
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < min || number > max)
+    {
+        return false;
+    }
+    *out = number;
+    return true;
+}
+
+// settings written by the /config endpoint take precedence over esp_wifi_interface_config_t
+static void wifi_nvs_load_overrides(esp_wifi_interface_handle_t handle)
+{
+    long value;
+    if (wifi_nvs_read_int(handle, "RETRY", 0, UINT8_MAX, &value))
+    {
+        handle->esp_max_retry = value;
+    }
+    if (wifi_nvs_read_int(handle, "APCH", 1, 13, &value))
+    {
+        handle->channel = value;
+    }
+    if (wifi_nvs_read_int(handle, "PWR", WIFI_PS_NONE, WIFI_PS_MAX_MODEM, &value))
+    {
+        handle->power_save_set = true;
+        handle->power_save = value;
+    }
+}
+
+// Called once, after the STA netif is created and before esp_wifi_start. With the DHCP client
+// stopped no DISCOVER is ever sent and esp_netif_action_connected posts IP_EVENT_STA_GOT_IP for
+// the static address on every association.
+static void wifi_apply_static_ip(esp_wifi_interface_handle_t handle)
+{
+    if (!handle->static_ip.enabled)
+    {
+        return;
+    }
+
+    esp_err_t err = esp_netif_dhcpc_stop(handle->netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED)
+    {
+        ESP_LOGE(tag_wifi, "Failed to stop dhcp client");
+        return;
+    }
+
+    esp_netif_ip_info_t ip_info = {
+        .ip = handle->static_ip.ip,
+        .netmask = handle->static_ip.netmask,
+        .gw = handle->static_ip.gw,
+    };
+    if (esp_netif_set_ip_info(handle->netif, &ip_info) != ESP_OK)
+    {
+        ESP_LOGE(tag_wifi, "Failed to set static ip");
+        return;
+    }
+
+    if (handle->static_ip.dns.addr)
+    {
+        esp_netif_dns_info_t dns = {0};
+        dns.ip.u_addr.ip4 = handle->static_ip.dns;
+        dns.ip.type = ESP_IPADDR_TYPE_V4;
+        esp_netif_set_dns_info(handle->netif, ESP_NETIF_DNS_MAIN, &dns);
+    }
+}
+
+static void ip_watchdog_probe_success(esp_ping_handle_t hdl, void *args)
+{
+    xEventGroupSetBits(s_wifi_event_group, WIFI_PROBE_OK_BIT);
+}
+
+static void ip_watchdog_probe_end(esp_ping_handle_t hdl, void *args)
+{
+    xEventGroupSetBits(s_wifi_event_group, WIFI_PROBE_DONE_BIT);
+}
+
+// restart the DHCP client so that a new DISCOVER goes out now instead of after the lwIP backoff
+static void wifi_redhcp(esp_wifi_interface_handle_t handle)
+{
+    if (handle->static_ip.enabled)
+    {
+        // no DHCP client to restart, reassociation is the only recovery
+        return;
+    }
+    ESP_LOGW(tag_wifi, "Restarting DHCP client");
+    esp_netif_dhcpc_stop(handle->netif);
+    esp_netif_dhcpc_start(handle->netif);
+}
+
+// Probes the gateway with a single ICMP echo, the interval and the recovery steps are decided by
+// ip_watchdog_on_probe (esp_wifi_ip_watchdog.c)
+static void ip_watchdog_task(void *arg)
+{
+    esp_wifi_interface_handle_t handle = (esp_wifi_interface_handle_t)arg;
+    esp_ping_handle_t ping = NULL;
+    uint32_t target_gw = 0;
+    ip_watchdog_config_t wdt_config = {
+        .min_interval_ms = handle->ip_watchdog_interval_ms,
+        .max_interval_ms = handle->ip_watchdog_max_interval_ms,
+        .max_failures = handle->ip_watchdog_max_failures,
+    };
+    ip_watchdog_state_t wdt;
+    ip_watchdog_reset(&wdt, &wdt_config);
+
+    esp_ping_callbacks_t cbs = {
+        .cb_args = NULL,
+        .on_ping_success = ip_watchdog_probe_success,
+        .on_ping_timeout = NULL,
+        .on_ping_end = ip_watchdog_probe_end,
+    };
+
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(wdt.interval_ms));
+
+        if (!(xEventGroupGetBits(s_wifi_event_group) & WIFI_ASSOCIATED_BIT))
+        {
+            // the event_handler retry path reconnects first, once it gave up (WIFI_STATE_DISCONNECTED)
+            // nothing waits on WIFI_FAIL_BIT any more and the watchdog restarts it after a backoff
+            bool exhausted = __atomic_load_n(&s_state.phase, __ATOMIC_RELAXED) == WIFI_STATE_DISCONNECTED;
+            if (ip_watchdog_on_link_down(&wdt, &wdt_config, exhausted) == IP_WATCHDOG_ACTION_RECONNECT)
+            {
+                ESP_LOGW(tag_wifi, "Retries exhausted, connecting to the AP again");
+                handle->s_retry_num = 0;
+                xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
+
+                esp_wifi_interface_state_t *state = state_write_begin();
+                state->phase = WIFI_STATE_CONNECTING;
+                state->retry_count = 0;
+                state_write_end();
+
+                esp_wifi_connect();
+            }
+            continue;
+        }
+
+        bool reachable = false;
+        esp_netif_ip_info_t ip_info;
+        if (esp_netif_get_ip_info(handle->netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0 && ip_info.gw.addr != 0)
+        {
+            if (ping == NULL || ip_info.gw.addr != target_gw)
+            {
+                if (ping)
+                {
+                    esp_ping_delete_session(ping);
+                    ping = NULL;
+                }
+                esp_ping_config_t ping_config = ESP_PING_DEFAULT_CONFIG();
+                ip_addr_t target_addr = IPADDR4_INIT(ip_info.gw.addr);
+                ping_config.target_addr = target_addr;
+                ping_config.count = 1;
+                ping_config.timeout_ms = WIFI_WATCHDOG_PROBE_TIMEOUT_MS;
+                if (esp_ping_new_session(&ping_config, &cbs, &ping) != ESP_OK)
+                {
+                    ESP_LOGE(tag_wifi, "Failed to create watchdog ping session");
+                    ping = NULL;
+                    continue;
+                }
+                target_gw = ip_info.gw.addr;
+            }
+
+            xEventGroupClearBits(s_wifi_event_group, WIFI_PROBE_OK_BIT | WIFI_PROBE_DONE_BIT);
+            esp_ping_start(ping);
+            EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group, WIFI_PROBE_DONE_BIT, pdTRUE, pdTRUE,
+                                                   pdMS_TO_TICKS(2 * WIFI_WATCHDOG_PROBE_TIMEOUT_MS));
+            if (!(bits & WIFI_PROBE_DONE_BIT))
+            {
+                esp_ping_stop(ping);
+            }
+            reachable = (bits & WIFI_PROBE_OK_BIT) != 0;
+        }
+
+        int rssi;
+        if (esp_wifi_sta_get_rssi(&rssi) == ESP_OK)
+        {
+            esp_wifi_interface_state_t *state = state_write_begin();
+            state->rssi = rssi;
+            state_write_end();
+        }
+
+        ip_watchdog_action_t action = ip_watchdog_on_probe(&wdt, &wdt_config, reachable);
+        if (!reachable)
+        {
+            ESP_LOGW(tag_wifi, "Gateway unreachable (%d/%d)", wdt.failures, 2 * wdt_config.max_failures);
+        }
+
+        if (action == IP_WATCHDOG_ACTION_REDHCP)
+        {
+            wifi_redhcp(handle);
+        }
+        else if (action == IP_WATCHDOG_ACTION_REASSOCIATE)
+        {
+            ESP_LOGW(tag_wifi, "Reassociating with the AP");
+            esp_wifi_disconnect();
+        }
+    }
+}
+
+static void ip_watchdog_start(esp_wifi_interface_handle_t handle)
+{
+    if (handle->ip_watchdog_interval_ms == 0)
+    {
+        return;
+    }
+
+    if (xTaskCreate(ip_watchdog_task, "wifi_ip_wdt", WIFI_WATCHDOG_TASK_STACK, handle,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS)
+    {
+        ESP_LOGE(tag_wifi, "Failed to start IP watchdog");
+        return;
+    }
+    ESP_LOGI(tag_wifi, "IP watchdog started, probe every %" PRIu32 "..%" PRIu32 " ms",
+             handle->ip_watchdog_interval_ms, handle->ip_watchdog_max_interval_ms);
+}
+
+// must be called with s_ap_lock held
+static wifi_ap_station_slot_t *ap_station_find(const uint8_t *mac)
+{
+    for (int i = 0; i < ESP_WIFI_MAX_CONN_NUM; i++)
+    {
+        if (s_ap_stations[i].used && memcmp(s_ap_stations[i].info.mac, mac, 6) == 0)
+        {
+            return &s_ap_stations[i];
+        }
+    }
+    return NULL;
+}
+
+// must be called with s_ap_lock held
+static bool ap_station_is_evicted(const uint8_t *mac, int64_t now)
+{
+    for (int i = 0; i < WIFI_AP_EVICTED_MAX; i++)
+    {
+        if (s_ap_evicted[i].until_us > now && memcmp(s_ap_evicted[i].mac, mac, 6) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void ap_event_handler(void *arg, esp_event_base_t event_base,
+                             int32_t event_id, void *event_data)
+{
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED)
+    {
+        wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
+        ESP_LOGI(tag_wifi, "station " MACSTR " joined, AID=%d", MAC2STR(event->mac), event->aid);
+
+        portENTER_CRITICAL(&s_ap_lock);
+        bool evicted = ap_station_is_evicted(event->mac, esp_timer_get_time());
+        portEXIT_CRITICAL(&s_ap_lock);
+        if (evicted)
+        {
+            // phones that saved the AP rejoin within seconds of being evicted
+            ESP_LOGI(tag_wifi, "Refusing recently evicted station AID=%d", event->aid);
+            esp_wifi_deauth_sta(event->aid);
+            return;
+        }
+
+        portENTER_CRITICAL(&s_ap_lock);
+        wifi_ap_station_slot_t *slot = ap_station_find(event->mac);
+        for (int i = 0; slot == NULL && i < ESP_WIFI_MAX_CONN_NUM; i++)
+        {
+            if (!s_ap_stations[i].used)
+            {
+                slot = &s_ap_stations[i];
+            }
+        }
+        if (slot)
+        {
+            memset(slot, 0, sizeof(*slot));
+            slot->used = true;
+            memcpy(slot->info.mac, event->mac, sizeof(slot->info.mac));
+            slot->info.aid = event->aid;
+            slot->info.connect_time_us = esp_timer_get_time();
+        }
+        portEXIT_CRITICAL(&s_ap_lock);
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED)
+    {
+        wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
+        ESP_LOGI(tag_wifi, "station " MACSTR " left, AID=%d", MAC2STR(event->mac), event->aid);
+
+        portENTER_CRITICAL(&s_ap_lock);
+        wifi_ap_station_slot_t *slot = ap_station_find(event->mac);
+        if (slot)
+        {
+            slot->used = false;
+        }
+        portEXIT_CRITICAL(&s_ap_lock);
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_AP_STAIPASSIGNED)
+    {
+        ip_event_ap_staipassigned_t *event = (ip_event_ap_staipassigned_t *)event_data;
+
+        portENTER_CRITICAL(&s_ap_lock);
+        wifi_ap_station_slot_t *slot = ap_station_find(event->mac);
+        if (slot)
+        {
+            slot->info.ip = event->ip;
+        }
+        portEXIT_CRITICAL(&s_ap_lock);
+    }
+}
+
+// account one HTTP request to the station it came from, matched by the leased address
+static void ap_station_account(httpd_req_t *req, size_t bytes_rx, size_t bytes_tx)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    uint32_t ip = 0;
+
+    if (getpeername(httpd_req_to_sockfd(req), (struct sockaddr *)&addr, &addr_len) != 0)
+    {
+        return;
+    }
+    if (addr.ss_family == AF_INET)
+    {
+        ip = ((struct sockaddr_in *)&addr)->sin_addr.s_addr;
+    }
+    else if (addr.ss_family == AF_INET6)
+    {
+        // httpd listens on an IPv6 socket when LWIP_IPV6 is enabled, IPv4 peers are IPv4-mapped
+        memcpy(&ip, &((struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr[12], sizeof(ip));
+    }
+
+    portENTER_CRITICAL(&s_ap_lock);
+    for (int i = 0; i < ESP_WIFI_MAX_CONN_NUM; i++)
+    {
+        if (s_ap_stations[i].used && ip != 0 && s_ap_stations[i].info.ip.addr == ip)
+        {
+            s_ap_stations[i].info.requests++;
+            s_ap_stations[i].info.bytes_rx += bytes_rx;
+            s_ap_stations[i].info.bytes_tx += bytes_tx;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&s_ap_lock);
+}
+
+static void ap_station_refresh_rssi()
+{
+    wifi_sta_list_t sta_list;
+    if (esp_wifi_ap_get_sta_list(&sta_list) != ESP_OK)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_ap_lock);
+    for (int i = 0; i < sta_list.num; i++)
+    {
+        wifi_ap_station_slot_t *slot = ap_station_find(sta_list.sta[i].mac);
+        if (slot)
+        {
+            slot->info.rssi = sta_list.sta[i].rssi;
+        }
+    }
+    portEXIT_CRITICAL(&s_ap_lock);
+}
+
+// Disconnect stations that never opened the portal, typically phones that auto-joined the AP
+// and hold one of the ap_max_connection slots. They are refused for WIFI_AP_EVICT_COOLDOWN_US
+// so they cannot take the slot back right away
+static void ap_station_sweep(esp_wifi_interface_handle_t handle)
+{
+    uint16_t idle_aid[ESP_WIFI_MAX_CONN_NUM];
+    int idle_count = 0;
+    int64_t now = esp_timer_get_time();
+
+    ap_station_refresh_rssi();
+    if (handle->ap_idle_timeout_ms == 0)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL(&s_ap_lock);
+    for (int i = 0; i < ESP_WIFI_MAX_CONN_NUM; i++)
+    {
+        esp_wifi_interface_ap_station_t *info = &s_ap_stations[i].info;
+        if (s_ap_stations[i].used && info->requests == 0 &&
+            now - info->connect_time_us > (int64_t)handle->ap_idle_timeout_ms * 1000)
+        {
+            idle_aid[idle_count++] = info->aid;
+            // the station stays in the table until WIFI_EVENT_AP_STADISCONNECTED, record it once
+            if (!ap_station_is_evicted(info->mac, now))
+            {
+                memcpy(s_ap_evicted[s_ap_evicted_next].mac, info->mac, 6);
+                s_ap_evicted[s_ap_evicted_next].until_us = now + WIFI_AP_EVICT_COOLDOWN_US;
+                s_ap_evicted_next = (s_ap_evicted_next + 1) % WIFI_AP_EVICTED_MAX;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&s_ap_lock);
+
+    for (int i = 0; i < idle_count; i++)
+    {
+        ESP_LOGI(tag_wifi, "Disconnecting idle station AID=%d", idle_aid[i]);
+        esp_wifi_deauth_sta(idle_aid[i]);
+    }
+}
 
 // convert a hex digit to its integer value
 static char from_hex(char ch)
@@ -185,141 +878,841 @@ static esp_err_t getssid_get_handler(httpd_req_t *req)
                 ESP_LOGI(tag_wifi, "Decoded query parameter => %s", dec_param);
             }
         }
-        free(buf);
+        free(buf);
+    }
+
+    /* Set some custom headers */
+    httpd_resp_set_hdr(req, "Custom-Header-1", "Custom-Value-1");
+    httpd_resp_set_hdr(req, "Custom-Header-2", "Custom-Value-2");
+
+
+    static char wifi_form_html[2048];
+    
+    sprintf(wifi_form_html,
+        "<!DOCTYPE html>"
+        "<html>"
+        "<head>"
+        "<style>"
+        "body {  margin: 0;  padding: 0;  font-family: 'Segoe UI', Tahoma, Geneva, Verdana, sans-serif;  background: linear-gradient(135deg, #e0eafc, #cfdef3);  display: flex;  flex-direction: column;  align-items: center;}"
+        ".container {  text-align: center;  background: white;  padding: 40px 60px;  border-radius: 16px;  box-shadow: 0 4px 20px rgba(0, 0, 0, 0.1);}"
+        "form-group {  margin: 10px 0;  width: 100%%;  max-width: 400px;  text-align: left; }"
+        "input {  width: 100%%;  padding: 10px;  font-size: 1rem;  margin-top: 5px;  border: 1px solid #ccc;  border-radius: 4px;}"
+        "button {  width: 100%%;  padding: 12px;  background-color: #007bff;  color: white;  border: none;  border-radius: 4px;  font-size: 1rem;  cursor: pointer;  margin-top: 10px; }"        
+        "</style>"
+        "</head>"
+        "<body>"
+        "<div class=\"container\">"
+        "<h2>Wi-Fi</h2>"
+        "<form action=\"/savessid\" method=\"post\">"
+        "SSID: <input name=\"ssid\" type=\"text\"> <br>"
+        "Password: <input name=\"password\" type=\"password\"><br>"
+        "Static IP (empty for DHCP): <input name=\"ip\" type=\"text\"><br>"
+        "Netmask: <input name=\"mask\" type=\"text\"><br>"
+        "Gateway: <input name=\"gw\" type=\"text\"><br>"
+        "DNS: <input name=\"dns\" type=\"text\"><br>"
+        "IPv6: <input name=\"ipv6\" type=\"checkbox\" value=\"1\"><br>"
+        "<button type=\"submit\">Enviar</button>"
+        "</form>"
+        "</div>"
+        "</body></html>");
+
+    /* Send response with custom headers and body set as the
+     * string passed in user context*/
+    const char *resp_str = (const char *)wifi_form_html;
+    httpd_resp_send(req, resp_str, HTTPD_RESP_USE_STRLEN);
+    ap_station_account(req, 0, strlen(resp_str));
+
+    /* After sending the HTTP response the old HTTP request
+     * headers are lost. Check if HTTP request headers can be read now. */
+    if (httpd_req_get_hdr_value_len(req, "Host") == 0)
+    {
+        ESP_LOGI(tag_wifi, "Request headers lost");
+    }
+    return ESP_OK;
+}
+
+static const httpd_uri_t getssid = {
+    .uri = "/getssid",
+    .method = HTTP_GET,
+    .handler = getssid_get_handler,
+    /* Let's pass response string in user
+     * context to demonstrate it's usage */
+    .user_ctx = NULL};
+
+// store one of the static IP form fields, an empty or invalid address is stored as "empty"
+static void save_ip4_field(esp_wifi_interface_handle_t handle, const char *nvs_key, const char *value)
+{
+    char addr_str[32] = {0};
+    esp_ip4_addr_t addr;
+
+    if (strlen(value) < sizeof(addr_str))
+    {
+        url_decode(addr_str, value);
+    }
+
+    esp_nvs_change_key(nvs_key, handle->nvs_handle);
+    if (addr_str[0] && esp_netif_str_to_ip4(addr_str, &addr) == ESP_OK)
+    {
+        esp_nvs_write_string(addr_str, handle->nvs_handle);
+    }
+    else
+    {
+        esp_nvs_write_string("empty", handle->nvs_handle);
+    }
+}
+
+/* An HTTP POST handler */
+static esp_err_t savessid_post_handler(httpd_req_t *req)
+{
+    char buf[1000];
+    int ret, remaining = req->content_len;
+    char ssid[100] = {0};
+    bool ssid_found = false;
+    bool ipv6 = false;
+
+    void *ctx = httpd_get_global_user_ctx(req->handle);
+    esp_wifi_interface_handle_t handle = (esp_wifi_interface_handle_t)ctx;
+
+    while (remaining > 0)
+    {
+        /* Read the data for the request */
+        if ((ret = httpd_req_recv(req, buf,
+                                  MIN(remaining, sizeof(buf)))) <= 0)
+        {
+            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+            {
+                /* Retry receiving if timeout occurred */
+                continue;
+            }
+            return ESP_FAIL;
+        }
+
+        /* Send back the same data */
+        httpd_resp_send_chunk(req, buf, ret);
+        remaining -= ret;
+
+        /* Log data received */
+        ESP_LOGI(tag_wifi, "=========== RECEIVED DATA ==========");
+        ESP_LOGI(tag_wifi, "%.*s", ret, buf);
+        ESP_LOGI(tag_wifi, "====================================");
+
+        char *saveptr1, *saveptr2;
+        char *str = strndup(buf, ret);
+        char *pair = strtok_r(str, "&", &saveptr1);
+        while (pair)
+        {
+            char *key = strtok_r(pair, "=", &saveptr2);
+            const char *value = strtok_r(NULL, "=", &saveptr2);
+            if (value == NULL)
+            {
+                // empty form field
+                value = "";
+            }
+            printf("Chave: %s, Valor: %s\n", key, value);
+            pair = strtok_r(NULL, "&", &saveptr1);
+            // if key == "ssid" or "password"
+            if (strcmp(key, "ssid") == 0)
+            {
+                // o SSID é salvo por último, o modo AP reinicia assim que ele muda
+                if (value[0] && strlen(value) < sizeof(ssid))
+                {
+                    url_decode(ssid, value);
+                    ssid_found = true;
+                }
+            }
+            else if (strcmp(key, "password") == 0)
+            {
+                // salva o valor na senha do handle
+                esp_nvs_change_key("PASS", handle->nvs_handle);
+                char pass[100] = {0};
+                if (strlen(value) < sizeof(pass))
+                {
+                    url_decode(pass, value);
+                }
+                esp_nvs_write_string(pass, handle->nvs_handle);
+            }
+            else if (strcmp(key, "ip") == 0)
+            {
+                save_ip4_field(handle, "IP", value);
+            }
+            else if (strcmp(key, "mask") == 0)
+            {
+                save_ip4_field(handle, "MASK", value);
+            }
+            else if (strcmp(key, "gw") == 0)
+            {
+                save_ip4_field(handle, "GW", value);
+            }
+            else if (strcmp(key, "dns") == 0)
+            {
+                save_ip4_field(handle, "DNS", value);
+            }
+            else if (strcmp(key, "ipv6") == 0)
+            {
+                ipv6 = strcmp(value, "1") == 0;
+            }
+            else
+            {
+                ESP_LOGI(tag_wifi, "Chave não reconhecida: %s", key);
+
+            }
+            
+        }
+        free(str);
+
+        // salva na memória
+    }
+
+    if (ssid_found)
+    {
+        // an unchecked checkbox is not posted, so IPV6 is always rewritten with the SSID
+        esp_nvs_change_key("IPV6", handle->nvs_handle);
+        esp_nvs_write_string(ipv6 ? "1" : "0", handle->nvs_handle);
+
+        esp_nvs_change_key("SSID", handle->nvs_handle);
+        esp_nvs_write_string(ssid, handle->nvs_handle);
+    }
+
+    // End response
+    httpd_resp_send_chunk(req, NULL, 0);
+    ap_station_account(req, req->content_len, req->content_len);
+    return ESP_OK;
+}
+
+static const httpd_uri_t savessid = {
+    .uri = "/savessid",
+    .method = HTTP_POST,
+    .handler = savessid_post_handler,
+    .user_ctx = NULL};
+
+// Bulk configuration posted as a single JSON document to /config:
+// {
+//   "ssid": "...", "password": "...",
+//   "max_retry": 10, "ap_channel": 6, "power_save": "none" | "min" | "max",
+//   "ipv6": true,
+//   "static_ip": {"ip": "...", "mask": "...", "gw": "...", "dns": "..."} | null
+// }
+// The body is tokenized as it arrives from httpd_req_recv, with a fixed token buffer and no
+// document tree. Nothing is written to NVS unless the whole document is valid.
+#define CONFIG_JSON_MAX_TOKEN (96)
+#define CONFIG_JSON_MAX_KEY (16)
+#define CONFIG_JSON_MAX_BODY (2048)
+
+typedef struct
+{
+    bool has_ssid;
+    char ssid[33];
+    bool has_password;
+    char password[65];
+    int max_retry;  // -1 when not present
+    int ap_channel; // -1 when not present
+    int power_save; // wifi_ps_type_t, -1 when not present
+    int ipv6;       // -1 when not present
+    bool has_static_ip;
+    bool has_static_field[4]; // ip, mask, gw, dns
+    wifi_static_ip_t static_ip;
+} wifi_bulk_config_t;
+
+typedef enum
+{
+    JSON_LEX_IDLE,
+    JSON_LEX_STRING,
+    JSON_LEX_ESCAPE,
+    JSON_LEX_UNICODE,
+    JSON_LEX_LITERAL,
+} json_lex_state_t;
+
+typedef enum
+{
+    JSON_EXPECT_OBJECT, // opening brace of the document
+    JSON_EXPECT_KEY,    // key or closing brace
+    JSON_EXPECT_MEMBER, // key after a comma
+    JSON_EXPECT_COLON,
+    JSON_EXPECT_VALUE,
+    JSON_EXPECT_NEXT, // comma or closing brace
+    JSON_DONE,
+} json_parse_state_t;
+
+typedef struct
+{
+    json_lex_state_t lex;
+    json_parse_state_t state;
+    uint8_t depth; // 1 inside the document, 2 inside static_ip
+    char token[CONFIG_JSON_MAX_TOKEN];
+    size_t token_len;
+    uint8_t unicode_digits;
+    uint16_t unicode;
+    char key[CONFIG_JSON_MAX_KEY];
+    const char *error;
+    wifi_bulk_config_t config;
+} config_json_parser_t;
+
+static const char *static_ip_fields[] = {"ip", "mask", "gw", "dns"};
+
+static void config_json_init(config_json_parser_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->config.max_retry = -1;
+    p->config.ap_channel = -1;
+    p->config.power_save = -1;
+    p->config.ipv6 = -1;
+}
+
+static bool config_json_fail(config_json_parser_t *p, const char *error)
+{
+    if (p->error == NULL)
+    {
+        p->error = error;
+    }
+    return false;
+}
+
+// 64 hex digits are a raw PSK, as accepted by wifi_sta_config_t.password
+static bool config_json_is_psk(const char *str, size_t len)
+{
+    if (len != 64)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isxdigit((unsigned char)str[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// JSON number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool config_json_is_number(const char *str)
+{
+    if (*str == '-')
+    {
+        str++;
+    }
+    if (*str == '0')
+    {
+        str++;
+    }
+    else if (*str >= '1' && *str <= '9')
+    {
+        while (isdigit((unsigned char)*str))
+        {
+            str++;
+        }
+    }
+    else
+    {
+        return false;
+    }
+    if (*str == '.')
+    {
+        str++;
+        if (!isdigit((unsigned char)*str))
+        {
+            return false;
+        }
+        while (isdigit((unsigned char)*str))
+        {
+            str++;
+        }
+    }
+    if (*str == 'e' || *str == 'E')
+    {
+        str++;
+        if (*str == '+' || *str == '-')
+        {
+            str++;
+        }
+        if (!isdigit((unsigned char)*str))
+        {
+            return false;
+        }
+        while (isdigit((unsigned char)*str))
+        {
+            str++;
+        }
+    }
+    return *str == '\0';
+}
+
+static bool config_json_parse_int(const char *str, int min, int max, int *out)
+{
+    char *end = NULL;
+    long value = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || value < min || value > max)
+    {
+        return false;
+    }
+    *out = (int)value;
+    return true;
+}
+
+// store one key/value pair in the staging configuration
+static bool config_json_apply(config_json_parser_t *p, bool is_string, const char *value)
+{
+    wifi_bulk_config_t *config = &p->config;
+    size_t len = strlen(value);
+
+    if (p->depth == 2)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (strcmp(p->key, static_ip_fields[i]) == 0)
+            {
+                esp_ip4_addr_t *addr[] = {&config->static_ip.ip, &config->static_ip.netmask,
+                                          &config->static_ip.gw, &config->static_ip.dns};
+                if (!is_string || esp_netif_str_to_ip4(value, addr[i]) != ESP_OK)
+                {
+                    return config_json_fail(p, "invalid static_ip address");
+                }
+                config->has_static_field[i] = true;
+                return true;
+            }
+        }
+    }
+    else if (strcmp(p->key, "ssid") == 0)
+    {
+        if (!is_string || len == 0 || len > 32)
+        {
+            return config_json_fail(p, "ssid must be 1 to 32 characters");
+        }
+        memcpy(config->ssid, value, len + 1);
+        config->has_ssid = true;
+        return true;
+    }
+    else if (strcmp(p->key, "password") == 0)
+    {
+        if (!is_string || (len != 0 && (len < 8 || len > 63) && !config_json_is_psk(value, len)))
+        {
+            return config_json_fail(p, "password must be empty, 8 to 63 characters or 64 hex digits");
+        }
+        memcpy(config->password, value, len + 1);
+        config->has_password = true;
+        return true;
+    }
+    else if (strcmp(p->key, "max_retry") == 0)
+    {
+        if (is_string || !config_json_parse_int(value, 0, UINT8_MAX, &config->max_retry))
+        {
+            return config_json_fail(p, "max_retry must be 0 to 255");
+        }
+        return true;
+    }
+    else if (strcmp(p->key, "ap_channel") == 0)
+    {
+        if (is_string || !config_json_parse_int(value, 1, 13, &config->ap_channel))
+        {
+            return config_json_fail(p, "ap_channel must be 1 to 13");
+        }
+        return true;
+    }
+    else if (strcmp(p->key, "power_save") == 0)
+    {
+        if (is_string && strcmp(value, "none") == 0)
+            config->power_save = WIFI_PS_NONE;
+        else if (is_string && strcmp(value, "min") == 0)
+            config->power_save = WIFI_PS_MIN_MODEM;
+        else if (is_string && strcmp(value, "max") == 0)
+            config->power_save = WIFI_PS_MAX_MODEM;
+        else
+            return config_json_fail(p, "power_save must be none, min or max");
+        return true;
+    }
+    else if (strcmp(p->key, "ipv6") == 0)
+    {
+        if (is_string || (strcmp(value, "true") != 0 && strcmp(value, "false") != 0))
+        {
+            return config_json_fail(p, "ipv6 must be a boolean");
+        }
+        config->ipv6 = strcmp(value, "true") == 0;
+        return true;
+    }
+    else if (strcmp(p->key, "static_ip") == 0)
+    {
+        if (is_string || strcmp(value, "null") != 0)
+        {
+            return config_json_fail(p, "static_ip must be an object or null");
+        }
+        // null switches back to DHCP, it also cancels an earlier static_ip object of the same document
+        config->has_static_ip = true;
+        memset(config->has_static_field, 0, sizeof(config->has_static_field));
+        memset(&config->static_ip, 0, sizeof(config->static_ip));
+        return true;
+    }
+
+    ESP_LOGI(tag_wifi, "Chave não reconhecida: %s", p->key);
+    return true;
+}
+
+static bool config_json_on_punct(config_json_parser_t *p, char c)
+{
+    switch (c)
+    {
+    case '{':
+        if (p->state == JSON_EXPECT_OBJECT)
+        {
+            p->depth = 1;
+            p->state = JSON_EXPECT_KEY;
+            return true;
+        }
+        if (p->state == JSON_EXPECT_VALUE && p->depth == 1 && strcmp(p->key, "static_ip") == 0)
+        {
+            // a repeated static_ip key replaces the previous one instead of merging with it
+            p->depth = 2;
+            p->config.has_static_ip = true;
+            memset(p->config.has_static_field, 0, sizeof(p->config.has_static_field));
+            memset(&p->config.static_ip, 0, sizeof(p->config.static_ip));
+            p->state = JSON_EXPECT_KEY;
+            return true;
+        }
+        return config_json_fail(p, "unexpected object");
+    case '}':
+        if (p->state != JSON_EXPECT_KEY && p->state != JSON_EXPECT_NEXT)
+        {
+            return config_json_fail(p, "unexpected '}'");
+        }
+        p->depth--;
+        p->state = p->depth == 0 ? JSON_DONE : JSON_EXPECT_NEXT;
+        return true;
+    case ':':
+        if (p->state != JSON_EXPECT_COLON)
+        {
+            return config_json_fail(p, "unexpected ':'");
+        }
+        p->state = JSON_EXPECT_VALUE;
+        return true;
+    case ',':
+        if (p->state != JSON_EXPECT_NEXT)
+        {
+            return config_json_fail(p, "unexpected ','");
+        }
+        p->state = JSON_EXPECT_MEMBER;
+        return true;
+    default:
+        return config_json_fail(p, "arrays are not supported");
+    }
+}
+
+// a complete string or literal (number, true, false, null) is in p->token
+static bool config_json_on_token(config_json_parser_t *p, bool is_string)
+{
+    p->token[p->token_len] = '\0';
+
+    if (is_string && (p->state == JSON_EXPECT_KEY || p->state == JSON_EXPECT_MEMBER))
+    {
+        // keys longer than any known key are kept empty and ignored
+        if (p->token_len < sizeof(p->key))
+        {
+            memcpy(p->key, p->token, p->token_len + 1);
+        }
+        else
+        {
+            p->key[0] = '\0';
+        }
+        p->state = JSON_EXPECT_COLON;
+        return true;
+    }
+    if (p->state != JSON_EXPECT_VALUE)
+    {
+        return config_json_fail(p, "unexpected value");
+    }
+    // checked for every key, unknown ones included
+    if (!is_string && strcmp(p->token, "true") != 0 && strcmp(p->token, "false") != 0 &&
+        strcmp(p->token, "null") != 0 && !config_json_is_number(p->token))
+    {
+        return config_json_fail(p, "invalid literal");
+    }
+    p->state = JSON_EXPECT_NEXT;
+    return config_json_apply(p, is_string, p->token);
+}
+
+static bool config_json_append(config_json_parser_t *p, char c)
+{
+    if (p->token_len >= sizeof(p->token) - 1)
+    {
+        return config_json_fail(p, "value too long");
+    }
+    p->token[p->token_len++] = c;
+    return true;
+}
+
+static bool config_json_is_literal(char c)
+{
+    return isalnum((unsigned char)c) || c == '-' || c == '+' || c == '.';
+}
+
+// feed the next chunk of the body, returns false once the document is known to be invalid
+static bool config_json_feed(config_json_parser_t *p, const char *data, size_t len)
+{
+    size_t i = 0;
+    while (i < len && p->error == NULL)
+    {
+        char c = data[i];
+        switch (p->lex)
+        {
+        case JSON_LEX_IDLE:
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            {
+                break;
+            }
+            if (p->state == JSON_DONE)
+            {
+                return config_json_fail(p, "data after the document");
+            }
+            if (c == '"')
+            {
+                p->token_len = 0;
+                p->lex = JSON_LEX_STRING;
+            }
+            else if (config_json_is_literal(c))
+            {
+                p->token_len = 0;
+                config_json_append(p, c);
+                p->lex = JSON_LEX_LITERAL;
+            }
+            else
+            {
+                config_json_on_punct(p, c);
+            }
+            break;
+        case JSON_LEX_STRING:
+            if (c == '"')
+            {
+                p->lex = JSON_LEX_IDLE;
+                config_json_on_token(p, true);
+            }
+            else if (c == '\\')
+            {
+                p->lex = JSON_LEX_ESCAPE;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                config_json_fail(p, "control character in string");
+            }
+            else
+            {
+                config_json_append(p, c);
+            }
+            break;
+        case JSON_LEX_ESCAPE:
+        {
+            const char *escapes = "\"\"\\\\//b\bf\fn\nr\rt\t";
+            const char *match = NULL;
+            for (const char *e = escapes; *e; e += 2)
+            {
+                if (*e == c)
+                {
+                    match = e;
+                    break;
+                }
+            }
+            if (c == 'u')
+            {
+                p->unicode = 0;
+                p->unicode_digits = 0;
+                p->lex = JSON_LEX_UNICODE;
+            }
+            else if (match)
+            {
+                config_json_append(p, match[1]);
+                p->lex = JSON_LEX_STRING;
+            }
+            else
+            {
+                config_json_fail(p, "invalid escape");
+            }
+            break;
+        }
+        case JSON_LEX_UNICODE:
+            if (!isxdigit((unsigned char)c))
+            {
+                config_json_fail(p, "invalid unicode escape");
+                break;
+            }
+            p->unicode = (p->unicode << 4) | from_hex(c);
+            if (++p->unicode_digits == 4)
+            {
+                // only ASCII escapes, UTF-8 can be sent unescaped
+                if (p->unicode == 0 || p->unicode >= 0x80)
+                {
+                    config_json_fail(p, "unsupported unicode escape");
+                    break;
+                }
+                config_json_append(p, (char)p->unicode);
+                p->lex = JSON_LEX_STRING;
+            }
+            break;
+        case JSON_LEX_LITERAL:
+            if (config_json_is_literal(c))
+            {
+                config_json_append(p, c);
+                break;
+            }
+            p->lex = JSON_LEX_IDLE;
+            config_json_on_token(p, false);
+            // the delimiter is processed again in JSON_LEX_IDLE
+            continue;
+        }
+        i++;
+    }
+    return p->error == NULL;
+}
+
+static bool config_json_finish(config_json_parser_t *p)
+{
+    if (p->error == NULL && (p->lex != JSON_LEX_IDLE || p->state != JSON_DONE))
+    {
+        config_json_fail(p, "incomplete document");
+    }
+    if (p->error)
+    {
+        return false;
+    }
+
+    wifi_bulk_config_t *config = &p->config;
+    if (!config->has_ssid)
+    {
+        return config_json_fail(p, "ssid is required");
+    }
+    if (config->has_static_ip)
+    {
+        // an object needs ip, mask and gw, null leaves all three unset
+        int fields = config->has_static_field[0] + config->has_static_field[1] + config->has_static_field[2];
+        if (fields != 0 && fields != 3)
+        {
+            return config_json_fail(p, "static_ip needs ip, mask and gw");
+        }
+        config->static_ip.enabled = fields == 3;
     }
+    return true;
+}
 
-    /* Set some custom headers */
-    httpd_resp_set_hdr(req, "Custom-Header-1", "Custom-Value-1");
-    httpd_resp_set_hdr(req, "Custom-Header-2", "Custom-Value-2");
-
+static void config_nvs_write_ip4(esp_wifi_interface_handle_t handle, const char *key, bool set, const esp_ip4_addr_t *addr)
+{
+    char addr_str[16];
+    esp_nvs_change_key(key, handle->nvs_handle);
+    if (set)
+    {
+        esp_ip4addr_ntoa(addr, addr_str, sizeof(addr_str));
+        esp_nvs_write_string(addr_str, handle->nvs_handle);
+    }
+    else
+    {
+        esp_nvs_write_string("empty", handle->nvs_handle);
+    }
+}
 
-    static char wifi_form_html[2048];
-    
-    sprintf(wifi_form_html,
-        "<!DOCTYPE html>"
-        "<html>"
-        "<head>"
-        "<style>"
-        "body {  margin: 0;  padding: 0;  font-family: 'Segoe UI', Tahoma, Geneva, Verdana, sans-serif;  background: linear-gradient(135deg, #e0eafc, #cfdef3);  display: flex;  flex-direction: column;  align-items: center;}"
-        ".container {  text-align: center;  background: white;  padding: 40px 60px;  border-radius: 16px;  box-shadow: 0 4px 20px rgba(0, 0, 0, 0.1);}"
-        "form-group {  margin: 10px 0;  width: 100%%;  max-width: 400px;  text-align: left; }"
-        "input {  width: 100%%;  padding: 10px;  font-size: 1rem;  margin-top: 5px;  border: 1px solid #ccc;  border-radius: 4px;}"
-        "button {  width: 100%%;  padding: 12px;  background-color: #007bff;  color: white;  border: none;  border-radius: 4px;  font-size: 1rem;  cursor: pointer;  margin-top: 10px; }"        
-        "</style>"
-        "</head>"
-        "<body>"
-        "<div class=\"container\">"
-        "<h2>Wi-Fi</h2>"
-        "<form action=\"/savessid\" method=\"post\">"
-        "SSID: <input name=\"ssid\" type=\"text\"> <br>"
-        "Password: <input name=\"password\" type=\"password\"><br>"
-        "<button type=\"submit\">Enviar</button>"
-        "</form>"
-        "</div>"
-        "</body></html>");
+static void config_nvs_write_int(esp_wifi_interface_handle_t handle, const char *key, int value)
+{
+    char value_str[12];
+    snprintf(value_str, sizeof(value_str), "%d", value);
+    esp_nvs_change_key(key, handle->nvs_handle);
+    esp_nvs_write_string(value_str, handle->nvs_handle);
+}
 
-    /* Send response with custom headers and body set as the
-     * string passed in user context*/
-    const char *resp_str = (const char *)wifi_form_html;
-    httpd_resp_send(req, resp_str, HTTPD_RESP_USE_STRLEN);
+// write a validated configuration, SSID goes last since the AP loop restarts as soon as it changes
+static void config_nvs_commit(esp_wifi_interface_handle_t handle, const wifi_bulk_config_t *config)
+{
+    esp_nvs_change_key("PASS", handle->nvs_handle);
+    esp_nvs_write_string(config->has_password ? config->password : "", handle->nvs_handle);
 
-    /* After sending the HTTP response the old HTTP request
-     * headers are lost. Check if HTTP request headers can be read now. */
-    if (httpd_req_get_hdr_value_len(req, "Host") == 0)
+    if (config->max_retry >= 0)
     {
-        ESP_LOGI(tag_wifi, "Request headers lost");
+        config_nvs_write_int(handle, "RETRY", config->max_retry);
+    }
+    if (config->ap_channel >= 0)
+    {
+        config_nvs_write_int(handle, "APCH", config->ap_channel);
+    }
+    if (config->power_save >= 0)
+    {
+        config_nvs_write_int(handle, "PWR", config->power_save);
+    }
+    if (config->has_static_ip)
+    {
+        const wifi_static_ip_t *static_ip = &config->static_ip;
+        config_nvs_write_ip4(handle, "IP", static_ip->enabled, &static_ip->ip);
+        config_nvs_write_ip4(handle, "MASK", static_ip->enabled, &static_ip->netmask);
+        config_nvs_write_ip4(handle, "GW", static_ip->enabled, &static_ip->gw);
+        config_nvs_write_ip4(handle, "DNS", static_ip->enabled && config->has_static_field[3], &static_ip->dns);
+    }
+    if (config->ipv6 >= 0)
+    {
+        esp_nvs_change_key("IPV6", handle->nvs_handle);
+        esp_nvs_write_string(config->ipv6 ? "1" : "0", handle->nvs_handle);
     }
-    return ESP_OK;
-}
 
-static const httpd_uri_t getssid = {
-    .uri = "/getssid",
-    .method = HTTP_GET,
-    .handler = getssid_get_handler,
-    /* Let's pass response string in user
-     * context to demonstrate it's usage */
-    .user_ctx = NULL};
+    esp_nvs_change_key("SSID", handle->nvs_handle);
+    esp_nvs_write_string(config->ssid, handle->nvs_handle);
+}
 
-/* An HTTP POST handler */
-static esp_err_t savessid_post_handler(httpd_req_t *req)
+/* Bulk configuration POST handler */
+static esp_err_t config_post_handler(httpd_req_t *req)
 {
-    char buf[1000];
+    char buf[128];
     int ret, remaining = req->content_len;
 
     void *ctx = httpd_get_global_user_ctx(req->handle);
     esp_wifi_interface_handle_t handle = (esp_wifi_interface_handle_t)ctx;
 
+    if (remaining > CONFIG_JSON_MAX_BODY)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "document too large");
+        ap_station_account(req, 0, strlen("document too large"));
+        return ESP_FAIL;
+    }
+
+    config_json_parser_t *parser = malloc(sizeof(config_json_parser_t));
+    ESP_RETURN_ON_FALSE(parser, ESP_ERR_NO_MEM, tag_wifi, "parser alloc failed");
+    config_json_init(parser);
+
     while (remaining > 0)
     {
-        /* Read the data for the request */
-        if ((ret = httpd_req_recv(req, buf,
-                                  MIN(remaining, sizeof(buf)))) <= 0)
+        if ((ret = httpd_req_recv(req, buf, MIN(remaining, sizeof(buf)))) <= 0)
         {
             if (ret == HTTPD_SOCK_ERR_TIMEOUT)
             {
-                /* Retry receiving if timeout occurred */
                 continue;
             }
+            free(parser);
             return ESP_FAIL;
         }
-
-        /* Send back the same data */
-        httpd_resp_send_chunk(req, buf, ret);
         remaining -= ret;
 
-        /* Log data received */
-        ESP_LOGI(tag_wifi, "=========== RECEIVED DATA ==========");
-        ESP_LOGI(tag_wifi, "%.*s", ret, buf);
-        ESP_LOGI(tag_wifi, "====================================");
-
-        char *saveptr1, *saveptr2;
-        char *str = strndup(buf, ret);
-        char *pair = strtok_r(str, "&", &saveptr1);
-        while (pair)
+        if (!config_json_feed(parser, buf, ret))
         {
-            char *key = strtok_r(pair, "=", &saveptr2);
-            char *value = strtok_r(NULL, "=", &saveptr2);
-            printf("Chave: %s, Valor: %s\n", key, value);
-            pair = strtok_r(NULL, "&", &saveptr1);
-            // if key == "ssid" or "password"
-            if (strcmp(key, "ssid") == 0)
-            {
-                // salva o valor no ssid do handle
-
-                esp_nvs_change_key("SSID", handle->nvs_handle);
-                char ssid[100];
-                url_decode(ssid, value);
-                esp_nvs_write_string(ssid, handle->nvs_handle);
-            }
-            else if (strcmp(key, "password") == 0)
-            {
-                // salva o valor na senha do handle
-                esp_nvs_change_key("PASS", handle->nvs_handle);
-                char pass[100];
-                url_decode(pass, value);
-                esp_nvs_write_string(pass, handle->nvs_handle);
-            }
-            else
-            {
-                ESP_LOGI(tag_wifi, "Chave não reconhecida: %s", key);
-
-            }
-            
+            // stop reading, the connection is closed after the error response
+            break;
         }
-        free(str);
+    }
 
-        // salva na memória
+    if (!config_json_finish(parser))
+    {
+        ESP_LOGE(tag_wifi, "Invalid configuration: %s", parser->error);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, parser->error);
+        // a rejected document still means the portal is in use, the station must not be evicted
+        ap_station_account(req, req->content_len - remaining, strlen(parser->error));
+        free(parser);
+        return ESP_FAIL;
     }
 
-    // End response
-    httpd_resp_send_chunk(req, NULL, 0);
+    config_nvs_commit(handle, &parser->config);
+    ESP_LOGI(tag_wifi, "Configuration saved for SSID: %s", parser->config.ssid);
+    free(parser);
+
+    const char *resp_str = "{\"status\":\"ok\"}";
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp_str, HTTPD_RESP_USE_STRLEN);
+    ap_station_account(req, req->content_len, strlen(resp_str));
     return ESP_OK;
 }
 
-static const httpd_uri_t savessid = {
-    .uri = "/savessid",
+static const httpd_uri_t config_uri = {
+    .uri = "/config",
     .method = HTTP_POST,
-    .handler = savessid_post_handler,
+    .handler = config_post_handler,
     .user_ctx = NULL};
 
 
@@ -336,7 +1729,7 @@ static httpd_handle_t start_webserver(esp_wifi_interface_handle_t handle1)
     printf("handle: %p\n", handle);
     printf("handle->nvs_handle webserver: %p\n", handle->nvs_handle);
     printf("handle->ssid webserver: %s\n", handle->ssid);
-    printf("handle->password webserver: %s\n", handle->password);
+    printf("handle->password webserver: %.64s\n", handle->password);
 
     // Start the httpd server
     ESP_LOGI(tag_wifi, "Starting server on port: '%d'", config.server_port);
@@ -346,6 +1739,7 @@ static httpd_handle_t start_webserver(esp_wifi_interface_handle_t handle1)
         ESP_LOGI(tag_wifi, "Registering URI handlers");
         httpd_register_uri_handler(server, &getssid);
         httpd_register_uri_handler(server, &savessid);
+        httpd_register_uri_handler(server, &config_uri);
         return server;
     }
 
@@ -369,8 +1763,21 @@ static void esp_wifi_restart()
     esp_restart();
 }
 
+// factory reset: everything written by the form or /config belongs to the forgotten network,
+// "empty" makes the readers fall back to DHCP and to esp_wifi_interface_config_t
 static void esp_wifi_forget()
 {
+    static const char *keys[] = {"IP", "MASK", "GW", "DNS", "RETRY", "APCH", "PWR"};
+
+    rtc_cache_invalidate();
+    wifi_nvs_open(wifi_interface_handle);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+        esp_nvs_change_key(keys[i], wifi_interface_handle->nvs_handle);
+        esp_nvs_write_string("empty", wifi_interface_handle->nvs_handle);
+    }
+    esp_nvs_change_key("IPV6", wifi_interface_handle->nvs_handle);
+    esp_nvs_write_string("0", wifi_interface_handle->nvs_handle);
     esp_nvs_change_key("SSID", wifi_interface_handle->nvs_handle);
     esp_nvs_write_string("empty", wifi_interface_handle->nvs_handle);
     esp_nvs_change_key("PASS", wifi_interface_handle->nvs_handle);
@@ -397,10 +1804,50 @@ static void event_handler(void *arg, esp_event_base_t event_base,
         esp_wifi_connect();
     }
 
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        boot_phase_mark(WIFI_BOOT_PHASE_CONNECTED);
+        rtc_cache_store_ap(event->bssid, event->channel);
+        xEventGroupSetBits(s_wifi_event_group, WIFI_ASSOCIATED_BIT);
+        if (wifi_interface_handle->ipv6)
+        {
+            esp_netif_create_ip6_linklocal(wifi_interface_handle->netif);
+        }
+
+        wifi_ap_record_t ap_info;
+        bool have_ap_info = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+
+        esp_wifi_interface_state_t *state = state_write_begin();
+        state->phase = WIFI_STATE_ASSOCIATED;
+        memcpy(state->bssid, event->bssid, sizeof(state->bssid));
+        state->channel = event->channel;
+        if (have_ap_info)
+        {
+            state->rssi = ap_info.rssi;
+        }
+        state_write_end();
+    }
+
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_ASSOCIATED_BIT);
+        if (wifi_interface_handle->fast_connect)
+        {
+            // the cached AP may have moved or changed channel, retry with a full scan
+            wifi_config_t wifi_config;
+            wifi_interface_handle->fast_connect = false;
+            if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) == ESP_OK)
+            {
+                wifi_config.sta.bssid_set = false;
+                wifi_config.sta.channel = 0;
+                esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+            }
+        }
 
-        if (wifi_interface_handle->s_retry_num < wifi_interface_handle->esp_max_retry)
+        bool retrying = wifi_interface_handle->s_retry_num < wifi_interface_handle->esp_max_retry;
+        if (retrying)
         {
             esp_wifi_connect();
             wifi_interface_handle->s_retry_num++;
@@ -414,16 +1861,78 @@ static void event_handler(void *arg, esp_event_base_t event_base,
             gpio_set_level(wifi_interface_handle->status_io, 0);
         }
         ESP_LOGI(tag_wifi, "connect to the AP fail");
+
+        esp_wifi_interface_state_t *state = state_write_begin();
+        state->phase = retrying ? WIFI_STATE_CONNECTING : WIFI_STATE_DISCONNECTED;
+        state->ip.addr = 0;
+        state->rssi = 0;
+        state->retry_count = wifi_interface_handle->s_retry_num;
+        state->last_disconnect_reason = event->reason;
+        state_set_local_ip(NULL);
+        memset(&wifi_interface_handle->ip_info, 0, sizeof(wifi_interface_handle->ip_info));
+        memset(&wifi_interface_handle->ip6_link_local, 0, sizeof(wifi_interface_handle->ip6_link_local));
+        memset(&wifi_interface_handle->ip6_global, 0, sizeof(wifi_interface_handle->ip6_global));
+        state_write_end();
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
+        if (!(xEventGroupGetBits(s_wifi_event_group) & WIFI_ASSOCIATED_BIT))
+        {
+            // a static address set before esp_wifi_start may be reported before any association
+            return;
+        }
+        boot_phase_mark(WIFI_BOOT_PHASE_GOT_IP);
         ESP_LOGI(tag_wifi, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
         wifi_interface_handle->s_retry_num = 0;
-        sprintf(wifi_interface_handle->local_ip, IPSTR, IP2STR(&event->ip_info.ip));
+
+        // published before WIFI_CONNECTED_BIT, WiFiSimpleConnection returns as soon as it is set
+        esp_wifi_interface_state_t *state = state_write_begin();
+        state_set_local_ip(&event->ip_info.ip);
+        wifi_interface_handle->ip_info = event->ip_info;
+        state->phase = WIFI_STATE_GOT_IP;
+        state->ip = event->ip_info.ip;
+        state->retry_count = 0;
+        state_write_end();
+
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
         gpio_set_level(wifi_interface_handle->status_io, 1);
     }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP)
+    {
+        // DHCP lease expired or was not renewed while still associated
+        ESP_LOGW(tag_wifi, "lost ip");
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        gpio_set_level(wifi_interface_handle->status_io, 0);
+
+        esp_wifi_interface_state_t *state = state_write_begin();
+        state_set_local_ip(NULL);
+        memset(&wifi_interface_handle->ip_info, 0, sizeof(wifi_interface_handle->ip_info));
+        state->phase = WIFI_STATE_ASSOCIATED;
+        state->ip.addr = 0;
+        state_write_end();
+
+        if (wifi_interface_handle->ip_watchdog_interval_ms)
+        {
+            wifi_redhcp(wifi_interface_handle);
+        }
+    }
+    else if (event_base == IP_EVENT && event_id == IP_EVENT_GOT_IP6)
+    {
+        ip_event_got_ip6_t *event = (ip_event_got_ip6_t *)event_data;
+        ESP_LOGI(tag_wifi, "got ipv6:" IPV6STR, IPV62STR(event->ip6_info.ip));
+        bool link_local = esp_netif_ip6_get_addr_type(&event->ip6_info.ip) == ESP_IP6_ADDR_IS_LINK_LOCAL;
+        state_write_begin();
+        if (link_local)
+        {
+            wifi_interface_handle->ip6_link_local = event->ip6_info.ip;
+        }
+        else
+        {
+            wifi_interface_handle->ip6_global = event->ip6_info.ip;
+        }
+        state_write_end();
+    }
 }
 
 static void disconnect_handler(void *arg, esp_event_base_t event_base,
@@ -459,9 +1968,11 @@ static void connect_handler(void *arg, esp_event_base_t event_base,
 
 esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
 {
+    boot_phase_mark(WIFI_BOOT_PHASE_INIT);
 
     esp_reset_reason_t reason = esp_reset_reason();
     ESP_LOGI(tag_wifi, "Reset reason: %d", reason);
+    bool warm_boot = (reason == ESP_RST_DEEPSLEEP) && rtc_cache_valid();
 
     esp_err_t ret = ESP_OK;
     esp_wifi_interface_t *wifi_interface = NULL;
@@ -471,6 +1982,14 @@ esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
     ESP_LOGI(tag_wifi, "Configuration done");
 
     wifi_interface = calloc(1, sizeof(esp_wifi_interface_t));
+    ESP_GOTO_ON_FALSE(wifi_interface, ESP_ERR_NO_MEM, err, tag_wifi, "no memory for wifi interface");
+
+    s_wifi_event_group = xEventGroupCreate();
+    ESP_GOTO_ON_FALSE(s_wifi_event_group, ESP_ERR_NO_MEM, err, tag_wifi, "no memory for event group");
+
+    ESP_GOTO_ON_FALSE(xTaskCreate(wifi_boot_task, "wifi_boot", WIFI_BOOT_TASK_STACK, NULL,
+                                  uxTaskPriorityGet(NULL), NULL) == pdPASS,
+                      ESP_ERR_NO_MEM, err, tag_wifi, "failed to create boot task");
 
     wifi_interface->channel = config->channel;
     wifi_interface->esp_max_retry = config->esp_max_retry;
@@ -478,6 +1997,11 @@ esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
     wifi_interface->wifi_sae_mode = config->wifi_sae_mode;
     wifi_interface->status_io = config->status_io;
     wifi_interface->reset_io = config->reset_io;
+    wifi_interface->ip_watchdog_interval_ms = config->ip_watchdog_interval_ms;
+    wifi_interface->ip_watchdog_max_interval_ms = MAX(config->ip_watchdog_max_interval_ms, config->ip_watchdog_interval_ms);
+    wifi_interface->ip_watchdog_max_failures = config->ip_watchdog_max_failures ? config->ip_watchdog_max_failures : WIFI_WATCHDOG_DEFAULT_FAILURES;
+    wifi_interface->ap_max_connection = config->ap_max_connection ? MIN(config->ap_max_connection, ESP_WIFI_MAX_CONN_NUM) : WIFI_AP_DEFAULT_MAX_CONNECTION;
+    wifi_interface->ap_idle_timeout_ms = config->ap_idle_timeout_ms;
 
     // Gpio configuration
     uint64_t gpio_pin_sel = (1ULL << wifi_interface->status_io);
@@ -495,42 +2019,67 @@ esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
     io_conf.pin_bit_mask = gpio_pin_sel;
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
+    boot_phase_mark(WIFI_BOOT_PHASE_GPIO);
 
-    esp_nvs_config_t esp_nvs_config = {
-        .name_space = "wifi_nvs",
-        .key = "SSID",
-        .value_size = 64,
-    };
+    if (warm_boot)
+    {
+        // the driver still needs the flash initialized for its PHY calibration data,
+        // but the wifi namespace is not opened nor read
+        if (nvs_flash_init() != ESP_OK)
+        {
+            ESP_LOGW(tag_wifi, "NVS flash init failed, ignoring warm-boot cache");
+            warm_boot = false;
+        }
+    }
+
+    if (warm_boot)
+    {
+        xEventGroupSetBits(s_wifi_event_group, WIFI_NVS_READY_BIT);
+        boot_phase_mark(WIFI_BOOT_PHASE_NVS);
+
+        wifi_interface->wifi_mode = sta;
+        memcpy(wifi_interface->ssid, s_rtc_cache.ssid, sizeof(wifi_interface->ssid));
+        memcpy(wifi_interface->password, s_rtc_cache.password, sizeof(wifi_interface->password));
+        wifi_interface->fast_connect = s_rtc_cache.bssid_valid;
+        wifi_interface->static_ip = s_rtc_cache.static_ip;
+        wifi_interface->ipv6 = s_rtc_cache.ipv6;
+        wifi_interface->esp_max_retry = s_rtc_cache.esp_max_retry;
+        wifi_interface->power_save_set = s_rtc_cache.power_save_set;
+        wifi_interface->power_save = s_rtc_cache.power_save;
+        boot_phase_mark(WIFI_BOOT_PHASE_CREDENTIALS);
+        ESP_LOGI(tag_wifi, "Warm boot, STA configuration restored from RTC memory");
+
+        wifi_interface_handle = wifi_interface;
+        return ESP_OK;
+    }
 
-    init_esp_nvs(&esp_nvs_config, &wifi_interface->nvs_handle);
+    wifi_nvs_open(wifi_interface);
+    xEventGroupSetBits(s_wifi_event_group, WIFI_NVS_READY_BIT);
+    boot_phase_mark(WIFI_BOOT_PHASE_NVS);
     ESP_LOGI(tag_wifi, "NVS Created Successfully");
 
+    // the namespace is opened with the SSID key selected
     char *p_ssid = NULL;
     esp_err_t ret_nvs = esp_nvs_read_string(wifi_interface->nvs_handle, &p_ssid);
 
     if (ret_nvs == ESP_ERR_NVS_NOT_FOUND)
     {
-        esp_nvs_change_key("SSID", wifi_interface->nvs_handle);
-        ESP_LOGI(tag_wifi, "Key changed to SSID");
         esp_nvs_write_string("empty", wifi_interface->nvs_handle);
 
         esp_nvs_change_key("PASS", wifi_interface->nvs_handle);
         ESP_LOGI(tag_wifi, "key changed to PASS");
         esp_nvs_write_string("empty", wifi_interface->nvs_handle);
     }
-
-    esp_nvs_change_key("SSID", wifi_interface->nvs_handle);
-    ESP_LOGI(tag_wifi, "Key changed to SSID");
-
-    if (esp_nvs_read_string(wifi_interface->nvs_handle, &p_ssid) != ESP_OK)
+    else if (ret_nvs != ESP_OK)
     {
         ESP_LOGI(tag_wifi, "Error to read SSID");
     }
 
-    if (strcmp(p_ssid, "empty") == 0)
+    if (ret_nvs != ESP_OK || p_ssid == NULL || strcmp(p_ssid, "empty") == 0)
     {
         wifi_interface->wifi_mode = ap; // modo AP
         ESP_LOGI(tag_wifi, "AP mode Activeted");
+        rtc_cache_invalidate();
     }
     else
     {
@@ -546,11 +2095,24 @@ esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
         {
             ESP_LOGE(tag_wifi, "Error to read Password");
         }
-        // Copiar a senha
-        memcpy(wifi_interface->password, p_password, strlen(p_password) + 1);
+        // Copiar a senha, uma PSK de 64 dígitos hex ocupa o buffer todo sem '\0'
+        strncpy((char *)wifi_interface->password, p_password, sizeof(wifi_interface->password));
+        wifi_nvs_load_static_ip(wifi_interface);
+    }
+
+    wifi_nvs_load_overrides(wifi_interface);
+    if (wifi_interface->wifi_mode == sta)
+    {
+        rtc_cache_store_credentials(wifi_interface);
     }
 
-    esp_nvs_list_namespaces();
+    boot_phase_mark(WIFI_BOOT_PHASE_CREDENTIALS);
+
+    // enumerating every namespace is only useful for debugging, keep it off the boot path
+    if (esp_log_level_get(tag_wifi) >= ESP_LOG_DEBUG)
+    {
+        esp_nvs_list_namespaces();
+    }
 
     wifi_interface_handle = wifi_interface;
     ESP_LOGI(tag_wifi, "Configuration done");
@@ -558,6 +2120,11 @@ esp_err_t WiFiInit(esp_wifi_interface_config_t *config)
     return ESP_OK;
 err:
     ESP_LOGE(tag_wifi, "Error to Conifgure");
+    if (s_wifi_event_group)
+    {
+        vEventGroupDelete(s_wifi_event_group);
+        s_wifi_event_group = NULL;
+    }
     if (wifi_interface)
     {
         free(wifi_interface);
@@ -574,25 +2141,26 @@ void WiFiSimpleConnection()
     ESP_LOGI(tag_wifi, "[APP] Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
     ESP_LOGI(tag_wifi, "[APP] IDF version: %s", esp_get_idf_version());
 
-    s_wifi_event_group = xEventGroupCreate();
-
-    // TCP/IP + event loop
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    // TCP/IP, event loop and driver are brought up by wifi_boot_task during WiFiInit
+    xEventGroupWaitBits(s_wifi_event_group, WIFI_STACK_READY_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    ESP_ERROR_CHECK(s_wifi_boot_err);
 
     // escolher entre criar netif para sta ou ap
     // esp_netif_create_default_wifi_ap();
     if (wifi_interface_handle->wifi_mode == sta)
     {
-        esp_netif_create_default_wifi_sta();
+        wifi_interface_handle->netif = esp_netif_create_default_wifi_sta();
+        wifi_apply_static_ip(wifi_interface_handle);
     }
     else if (wifi_interface_handle->wifi_mode == ap)
     {
-        esp_netif_create_default_wifi_ap();
+        wifi_interface_handle->netif = esp_netif_create_default_wifi_ap();
     }
 
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    esp_wifi_interface_state_t *state = state_write_begin();
+    state->mode = wifi_interface_handle->wifi_mode == sta ? WIFI_MODE_STA : WIFI_MODE_AP;
+    state->phase = wifi_interface_handle->wifi_mode == sta ? WIFI_STATE_CONNECTING : WIFI_STATE_PROVISIONING;
+    state_write_end();
 
     wifi_config_t wifi_config_sta = {
         .sta = {
@@ -607,9 +2175,9 @@ void WiFiSimpleConnection()
         .ap = {
             .ssid = SSID_PA,
             .ssid_len = strlen(SSID_PA),
-            .channel = 1,
+            .channel = wifi_interface_handle->channel ? wifi_interface_handle->channel : 1,
             .password = SSID_PASS_PA,
-            .max_connection = 4,
+            .max_connection = wifi_interface_handle->ap_max_connection,
             .authmode = WIFI_AUTH_WPA2_PSK,
             .pmf_cfg = {
                 .required = true,
@@ -630,19 +2198,25 @@ void WiFiSimpleConnection()
         memcpy(wifi_config_sta.sta.ssid, wifi_interface_handle->ssid, sizeof(wifi_config_sta.sta.ssid));
         memcpy(wifi_config_sta.sta.password, wifi_interface_handle->password, sizeof(wifi_config_sta.sta.password));
 
+        if (wifi_interface_handle->fast_connect)
+        {
+            // skip the scan, go straight to the AP used before deep sleep
+            wifi_config_sta.sta.bssid_set = true;
+            memcpy(wifi_config_sta.sta.bssid, s_rtc_cache.bssid, sizeof(wifi_config_sta.sta.bssid));
+            wifi_config_sta.sta.channel = s_rtc_cache.ap_channel;
+        }
+
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
         ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config_sta)); // comentado para fazer scan
     }
 
-    esp_err_t ret = esp_wifi_start();
-
-    printf("%s\n", esp_err_to_name(ret));
-    ESP_ERROR_CHECK(ret);
-
     if (wifi_interface_handle->wifi_mode == sta)
     {
+        // registered before esp_wifi_start so that WIFI_EVENT_STA_START starts the connection
         esp_event_handler_instance_t instance_any_id;
         esp_event_handler_instance_t instance_got_ip;
+        esp_event_handler_instance_t instance_lost_ip;
+        esp_event_handler_instance_t instance_got_ip6;
         ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
                                                             ESP_EVENT_ANY_ID,
                                                             &event_handler,
@@ -653,8 +2227,39 @@ void WiFiSimpleConnection()
                                                             &event_handler,
                                                             NULL,
                                                             &instance_got_ip));
+        ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                            IP_EVENT_STA_LOST_IP,
+                                                            &event_handler,
+                                                            NULL,
+                                                            &instance_lost_ip));
+        ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT,
+                                                            IP_EVENT_GOT_IP6,
+                                                            &event_handler,
+                                                            NULL,
+                                                            &instance_got_ip6));
+    }
+    else if (wifi_interface_handle->wifi_mode == ap)
+    {
+        // registered before esp_wifi_start, a station joining before that would never get a slot
+        // and could never be evicted
+        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, &ap_event_handler, NULL));
+        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, &ap_event_handler, NULL));
+        ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &ap_event_handler, NULL));
+    }
 
-        esp_wifi_connect();
+    esp_err_t ret = esp_wifi_start();
+
+    printf("%s\n", esp_err_to_name(ret));
+    ESP_ERROR_CHECK(ret);
+    boot_phase_mark(WIFI_BOOT_PHASE_START);
+
+    if (wifi_interface_handle->wifi_mode == sta && wifi_interface_handle->power_save_set)
+    {
+        esp_wifi_set_ps(wifi_interface_handle->power_save);
+    }
+
+    if (wifi_interface_handle->wifi_mode == sta)
+    {
         ESP_LOGI(tag_wifi, "wifi_connect finished.");
 
         /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
@@ -670,12 +2275,13 @@ void WiFiSimpleConnection()
          * happened. */
         if (bits & WIFI_CONNECTED_BIT)
         {
-            ESP_LOGI(tag_wifi, "connected to ap SSID:%s password:%s",
+            ESP_LOGI(tag_wifi, "connected to ap SSID:%s password:%.64s",
                      wifi_interface_handle->ssid, wifi_interface_handle->password);
+            ip_watchdog_start(wifi_interface_handle);
         }
         else if (bits & WIFI_FAIL_BIT)
         {
-            ESP_LOGI(tag_wifi, "Failed to connect to SSID:%s, password:%s",
+            ESP_LOGI(tag_wifi, "Failed to connect to SSID:%s, password:%.64s",
                      wifi_interface_handle->ssid, wifi_interface_handle->password);
 
             esp_wifi_forget();
@@ -708,9 +2314,15 @@ void WiFiSimpleConnection()
 
         char *p_ssid = NULL;
         bool status_io_aux = false;
+        int64_t last_sweep = esp_timer_get_time();
         while (wifi_interface_handle->server)
         {
             vTaskDelay(200 / portTICK_PERIOD_MS);
+            if (esp_timer_get_time() - last_sweep >= WIFI_AP_SWEEP_PERIOD_US)
+            {
+                last_sweep = esp_timer_get_time();
+                ap_station_sweep(wifi_interface_handle);
+            }
             status_io_aux = !status_io_aux;
             gpio_set_level(wifi_interface_handle->status_io, status_io_aux);
             esp_nvs_change_key("SSID", wifi_interface_handle->nvs_handle);
@@ -733,5 +2345,106 @@ void WiFiSimpleConnection()
 
 const char *WiFiGetLocalIP()
 {
-    return wifi_interface_handle->local_ip;
-}
\ No newline at end of file
+    return wifi_interface_handle->local_ip[__atomic_load_n(&wifi_interface_handle->local_ip_index, __ATOMIC_ACQUIRE)];
+}
+
+void WiFiGetState(esp_wifi_interface_state_t *state)
+{
+    uint32_t seq_begin, seq_end;
+    do
+    {
+        seq_begin = __atomic_load_n(&s_state_seq, __ATOMIC_ACQUIRE);
+        memcpy(state, &s_state, sizeof(*state));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_end = __atomic_load_n(&s_state_seq, __ATOMIC_RELAXED);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+}
+
+bool WiFiIsConnected()
+{
+    return __atomic_load_n(&s_state.phase, __ATOMIC_RELAXED) == WIFI_STATE_GOT_IP;
+}
+
+void WiFiSetStateCallback(esp_wifi_interface_state_cb_t cb, void *arg)
+{
+    portENTER_CRITICAL(&s_state_lock);
+    s_state_cb = cb;
+    s_state_cb_arg = arg;
+    portEXIT_CRITICAL(&s_state_lock);
+}
+
+esp_err_t WiFiGetLocalIPInfo(esp_wifi_interface_ip_t *ip)
+{
+    ESP_RETURN_ON_FALSE(ip, ESP_ERR_INVALID_ARG, tag_wifi, "Invalid argument");
+    ESP_RETURN_ON_FALSE(wifi_interface_handle, ESP_ERR_INVALID_STATE, tag_wifi, "WiFiInit not called");
+
+    memset(ip, 0, sizeof(*ip));
+    uint32_t seq_begin, seq_end;
+    do
+    {
+        seq_begin = __atomic_load_n(&s_state_seq, __ATOMIC_ACQUIRE);
+        ip->ip4 = wifi_interface_handle->ip_info;
+        ip->ip6_link_local = wifi_interface_handle->ip6_link_local;
+        ip->ip6_global = wifi_interface_handle->ip6_global;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_end = __atomic_load_n(&s_state_seq, __ATOMIC_RELAXED);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+    ip->is_static = wifi_interface_handle->static_ip.enabled;
+
+    esp_netif_dns_info_t dns;
+    if (wifi_interface_handle->netif &&
+        esp_netif_get_dns_info(wifi_interface_handle->netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK &&
+        dns.ip.type == ESP_IPADDR_TYPE_V4)
+    {
+        ip->dns = dns.ip.u_addr.ip4;
+    }
+    return ESP_OK;
+}
+
+esp_err_t WiFiGetAPStations(esp_wifi_interface_ap_station_t *stations, size_t *count)
+{
+    ESP_RETURN_ON_FALSE(stations && count, ESP_ERR_INVALID_ARG, tag_wifi, "Invalid argument");
+
+    if (wifi_interface_handle && wifi_interface_handle->wifi_mode == ap)
+    {
+        ap_station_refresh_rssi();
+    }
+
+    size_t copied = 0;
+    portENTER_CRITICAL(&s_ap_lock);
+    for (int i = 0; i < ESP_WIFI_MAX_CONN_NUM && copied < *count; i++)
+    {
+        if (s_ap_stations[i].used)
+        {
+            stations[copied++] = s_ap_stations[i].info;
+        }
+    }
+    portEXIT_CRITICAL(&s_ap_lock);
+
+    *count = copied;
+    return ESP_OK;
+}
+
+int64_t WiFiGetBootPhaseTime(esp_wifi_interface_boot_phase_t phase)
+{
+    if (phase >= WIFI_BOOT_PHASE_MAX)
+    {
+        return 0;
+    }
+    return s_boot_phase_time[phase];
+}
+
+void WiFiLogBootProfile()
+{
+    int64_t start = s_boot_phase_time[WIFI_BOOT_PHASE_INIT];
+    for (int i = 0; i < WIFI_BOOT_PHASE_MAX; i++)
+    {
+        if (s_boot_phase_time[i] == 0)
+        {
+            ESP_LOGI(tag_wifi, "boot %-12s: -", boot_phase_name[i]);
+            continue;
+        }
+        ESP_LOGI(tag_wifi, "boot %-12s: %" PRId64 " us (+%" PRId64 " us)",
+                 boot_phase_name[i], s_boot_phase_time[i], s_boot_phase_time[i] - start);
+    }
+}
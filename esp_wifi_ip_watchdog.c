@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2025 Tulio Carvalho
+Licensed under the MIT License. See LICENSE file for details.
+*/
+
+#include "esp_wifi_ip_watchdog.h"
+
+#include <stddef.h>
+
+void ip_watchdog_reset(ip_watchdog_state_t *state, const ip_watchdog_config_t *config)
+{
+    state->interval_ms = config->min_interval_ms;
+    state->failures = 0;
+    state->reconnect_backoff_ms = config->min_interval_ms;
+    state->reconnect_pending = false;
+}
+
+static uint32_t ip_watchdog_double(uint32_t interval_ms, uint32_t max_interval_ms)
+{
+    return interval_ms > max_interval_ms / 2 ? max_interval_ms : interval_ms * 2;
+}
+
+// The interval doubles up to the maximum while the gateway answers and falls back to the minimum on
+// the first failure. After max_failures consecutive failures the DHCP lease is renewed, after twice
+// as many the STA is reassociated and the count starts over.
+ip_watchdog_action_t ip_watchdog_on_probe(ip_watchdog_state_t *state, const ip_watchdog_config_t *config, bool reachable)
+{
+    if (reachable)
+    {
+        state->failures = 0;
+        state->interval_ms = ip_watchdog_double(state->interval_ms, config->max_interval_ms);
+        state->reconnect_backoff_ms = config->min_interval_ms;
+        return IP_WATCHDOG_ACTION_NONE;
+    }
+
+    state->failures++;
+    state->interval_ms = config->min_interval_ms;
+
+    if (state->failures >= 2 * (uint16_t)config->max_failures)
+    {
+        state->failures = 0;
+        return IP_WATCHDOG_ACTION_REASSOCIATE;
+    }
+    if (state->failures == config->max_failures)
+    {
+        return IP_WATCHDOG_ACTION_REDHCP;
+    }
+    return IP_WATCHDOG_ACTION_NONE;
+}
+
+// While the retry path is still connecting the link is checked at the minimum interval. Once it gave
+// up, the watchdog waits the backoff and reconnects, the backoff doubles up to the maximum interval
+// on every attempt that does not bring the gateway back.
+ip_watchdog_action_t ip_watchdog_on_link_down(ip_watchdog_state_t *state, const ip_watchdog_config_t *config, bool retries_exhausted)
+{
+    state->failures = 0;
+
+    if (!retries_exhausted)
+    {
+        state->interval_ms = config->min_interval_ms;
+        state->reconnect_pending = false;
+        return IP_WATCHDOG_ACTION_NONE;
+    }
+
+    if (!state->reconnect_pending)
+    {
+        state->reconnect_pending = true;
+        state->interval_ms = state->reconnect_backoff_ms;
+        return IP_WATCHDOG_ACTION_NONE;
+    }
+
+    state->reconnect_pending = false;
+    state->interval_ms = config->min_interval_ms;
+    state->reconnect_backoff_ms = ip_watchdog_double(state->reconnect_backoff_ms, config->max_interval_ms);
+    return IP_WATCHDOG_ACTION_RECONNECT;
+}
@@ -19,11 +19,17 @@ void app_main(void)
         .esp_wifi_scan_auth_mode_treshold = WIFI_AUTH_WPA_WPA2_PSK, // Authentication mode threshold for Wi-Fi scan
         .status_io = LED_STATUS,  // Connection status. 
         .reset_io = 0,           // Reset pin.
+        .ip_watchdog_interval_ms = 2000,       // Gateway probe interval after a failure (0 disables it)
+        .ip_watchdog_max_interval_ms = 60000,  // Probe interval while the gateway answers
+        .ip_watchdog_max_failures = 3,         // Failed probes before re-DHCP
+        .ap_max_connection = 4,                // Stations allowed on the provisioning AP
+        .ap_idle_timeout_ms = 60000,           // Disconnect stations that never open the portal
     };
     
     WiFiInit (&wifi_inteface_config);
 
     WiFiSimpleConnection();
+    WiFiLogBootProfile();
 
     char my_ip[16];
     snprintf(my_ip, sizeof(my_ip), "%s", WiFiGetLocalIP());
@@ -0,0 +1,298 @@
+/*
+Copyright (c) 2025 Tulio Carvalho
+Licensed under the MIT License. See LICENSE file for details.
+*/
+
+// Drives the IP watchdog state machine against a simulated gateway: the simulation advances a
+// clock by the interval the watchdog asks for, probes the fake gateway and applies the recovery
+// action, the same loop ip_watchdog_task runs on the target.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_wifi_ip_watchdog.h"
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                       \
+        }                                                                  \
+    } while (0)
+
+// Stand-in gateway, answers except during [down_from_ms, down_until_ms). A broken lease is fixed by
+// the recovery action given in heals_on, which brings the gateway back immediately.
+typedef struct
+{
+    uint64_t down_from_ms;
+    uint64_t down_until_ms;
+    ip_watchdog_action_t heals_on;
+} fake_gateway_t;
+
+static bool fake_gateway_answers(const fake_gateway_t *gw, uint64_t now_ms)
+{
+    return now_ms < gw->down_from_ms || now_ms >= gw->down_until_ms;
+}
+
+typedef struct
+{
+    uint64_t now_ms;
+    uint32_t probes;
+    uint32_t redhcp;
+    uint32_t reassociate;
+    uint64_t first_action_ms; // time of the first recovery action, 0 if none
+} sim_result_t;
+
+static sim_result_t simulate(fake_gateway_t *gw, const ip_watchdog_config_t *config, uint64_t duration_ms)
+{
+    sim_result_t result = {0};
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, config);
+
+    while (result.now_ms < duration_ms)
+    {
+        result.now_ms += state.interval_ms;
+        result.probes++;
+        ip_watchdog_action_t action = ip_watchdog_on_probe(&state, config, fake_gateway_answers(gw, result.now_ms));
+        if (action == IP_WATCHDOG_ACTION_NONE)
+        {
+            continue;
+        }
+
+        if (result.first_action_ms == 0)
+        {
+            result.first_action_ms = result.now_ms;
+        }
+        if (action == IP_WATCHDOG_ACTION_REDHCP)
+        {
+            result.redhcp++;
+        }
+        else
+        {
+            result.reassociate++;
+        }
+        if (action == gw->heals_on)
+        {
+            gw->down_until_ms = result.now_ms;
+        }
+    }
+    return result;
+}
+
+static const ip_watchdog_config_t default_config = {
+    .min_interval_ms = 1000,
+    .max_interval_ms = 60000,
+    .max_failures = 3,
+};
+
+static void test_interval_backs_off_while_gateway_answers()
+{
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+    CHECK(state.interval_ms == 1000);
+
+    uint32_t expected[] = {2000, 4000, 8000, 16000, 32000, 60000, 60000};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        CHECK(ip_watchdog_on_probe(&state, &default_config, true) == IP_WATCHDOG_ACTION_NONE);
+        CHECK(state.interval_ms == expected[i]);
+    }
+}
+
+static void test_single_failure_drops_to_minimum()
+{
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+    for (int i = 0; i < 10; i++)
+    {
+        ip_watchdog_on_probe(&state, &default_config, true);
+    }
+    CHECK(ip_watchdog_on_probe(&state, &default_config, false) == IP_WATCHDOG_ACTION_NONE);
+    CHECK(state.interval_ms == 1000);
+    CHECK(state.failures == 1);
+
+    CHECK(ip_watchdog_on_probe(&state, &default_config, true) == IP_WATCHDOG_ACTION_NONE);
+    CHECK(state.failures == 0);
+    CHECK(state.interval_ms == 2000);
+}
+
+static void test_redhcp_then_reassociate()
+{
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+
+    ip_watchdog_action_t expected[] = {
+        IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_REDHCP,
+        IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_REASSOCIATE,
+        // the count starts over after reassociating
+        IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_NONE, IP_WATCHDOG_ACTION_REDHCP,
+    };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        CHECK(ip_watchdog_on_probe(&state, &default_config, false) == expected[i]);
+        CHECK(state.interval_ms == 1000);
+    }
+}
+
+static void test_large_max_failures_reaches_reassociation()
+{
+    ip_watchdog_config_t config = default_config;
+    config.max_failures = 200;
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &config);
+
+    int redhcp = 0;
+    for (int i = 1; i <= 400; i++)
+    {
+        ip_watchdog_action_t action = ip_watchdog_on_probe(&state, &config, false);
+        if (action == IP_WATCHDOG_ACTION_REDHCP)
+        {
+            CHECK(i == 200);
+            redhcp++;
+        }
+        CHECK((action == IP_WATCHDOG_ACTION_REASSOCIATE) == (i == 400));
+    }
+    CHECK(redhcp == 1);
+}
+
+static void test_broken_lease_fixed_by_redhcp()
+{
+    fake_gateway_t gw = {
+        .down_from_ms = 10 * 60 * 1000,
+        .down_until_ms = UINT64_MAX,
+        .heals_on = IP_WATCHDOG_ACTION_REDHCP,
+    };
+    sim_result_t result = simulate(&gw, &default_config, 60 * 60 * 1000);
+
+    CHECK(result.redhcp == 1);
+    CHECK(result.reassociate == 0);
+    // detected within one slow probe plus max_failures - 1 fast ones
+    CHECK(result.first_action_ms - gw.down_from_ms <= default_config.max_interval_ms + 2 * default_config.min_interval_ms);
+}
+
+static void test_dead_upstream_fixed_by_reassociation()
+{
+    fake_gateway_t gw = {
+        .down_from_ms = 5 * 60 * 1000,
+        .down_until_ms = UINT64_MAX,
+        .heals_on = IP_WATCHDOG_ACTION_REASSOCIATE,
+    };
+    sim_result_t result = simulate(&gw, &default_config, 60 * 60 * 1000);
+
+    CHECK(result.redhcp == 1);
+    CHECK(result.reassociate == 1);
+}
+
+static void test_short_outage_needs_no_recovery()
+{
+    fake_gateway_t gw = {
+        .down_from_ms = 20 * 60 * 1000,
+        .down_until_ms = 20 * 60 * 1000 + 1500,
+        .heals_on = IP_WATCHDOG_ACTION_NONE,
+    };
+    sim_result_t result = simulate(&gw, &default_config, 60 * 60 * 1000);
+
+    CHECK(result.redhcp == 0);
+    CHECK(result.reassociate == 0);
+}
+
+static void test_stable_gateway_probe_cost()
+{
+    fake_gateway_t gw = {
+        .down_from_ms = UINT64_MAX,
+        .down_until_ms = UINT64_MAX,
+        .heals_on = IP_WATCHDOG_ACTION_NONE,
+    };
+    sim_result_t result = simulate(&gw, &default_config, 60 * 60 * 1000);
+
+    // 6 probes to reach the ceiling, then one per minute
+    CHECK(result.probes <= 6 + 60);
+    CHECK(result.redhcp == 0 && result.reassociate == 0);
+}
+
+static void test_link_down_while_retrying()
+{
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+    for (int i = 0; i < 10; i++)
+    {
+        ip_watchdog_on_probe(&state, &default_config, true);
+    }
+
+    CHECK(ip_watchdog_on_link_down(&state, &default_config, false) == IP_WATCHDOG_ACTION_NONE);
+    CHECK(state.interval_ms == 1000);
+    CHECK(!state.reconnect_pending);
+}
+
+static void test_reconnect_backoff_after_retries_exhausted()
+{
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+
+    uint32_t expected_wait[] = {1000, 2000, 4000, 8000, 16000, 32000, 60000, 60000};
+    for (size_t i = 0; i < sizeof(expected_wait) / sizeof(expected_wait[0]); i++)
+    {
+        // backoff before reconnecting
+        CHECK(ip_watchdog_on_link_down(&state, &default_config, true) == IP_WATCHDOG_ACTION_NONE);
+        CHECK(state.interval_ms == expected_wait[i]);
+        CHECK(ip_watchdog_on_link_down(&state, &default_config, true) == IP_WATCHDOG_ACTION_RECONNECT);
+        CHECK(state.interval_ms == 1000);
+        // the retry path runs again and gives up
+        CHECK(ip_watchdog_on_link_down(&state, &default_config, false) == IP_WATCHDOG_ACTION_NONE);
+    }
+
+    // a gateway answer resets the backoff
+    ip_watchdog_on_probe(&state, &default_config, true);
+    CHECK(ip_watchdog_on_link_down(&state, &default_config, true) == IP_WATCHDOG_ACTION_NONE);
+    CHECK(state.interval_ms == 1000);
+}
+
+// AP switched off for 10 minutes: the retry path gives up right away, the watchdog keeps
+// reconnecting and the link is back within one maximum backoff after the AP returns
+static void test_device_reconnects_when_ap_returns()
+{
+    const uint64_t ap_back_ms = 10 * 60 * 1000;
+    ip_watchdog_state_t state;
+    ip_watchdog_reset(&state, &default_config);
+
+    uint64_t now_ms = 0;
+    uint64_t reconnected_ms = 0;
+    int reconnects = 0;
+    while (reconnected_ms == 0 && now_ms < 60 * 60 * 1000)
+    {
+        now_ms += state.interval_ms;
+        if (ip_watchdog_on_link_down(&state, &default_config, true) != IP_WATCHDOG_ACTION_RECONNECT)
+        {
+            continue;
+        }
+        reconnects++;
+        if (now_ms >= ap_back_ms)
+        {
+            reconnected_ms = now_ms;
+        }
+    }
+
+    CHECK(reconnected_ms != 0);
+    CHECK(reconnected_ms - ap_back_ms <= default_config.max_interval_ms + default_config.min_interval_ms);
+    // backoff keeps the attempts bounded
+    CHECK(reconnects < 20);
+}
+
+int main()
+{
+    test_interval_backs_off_while_gateway_answers();
+    test_single_failure_drops_to_minimum();
+    test_redhcp_then_reassociate();
+    test_large_max_failures_reaches_reassociation();
+    test_broken_lease_fixed_by_redhcp();
+    test_dead_upstream_fixed_by_reassociation();
+    test_short_outage_needs_no_recovery();
+    test_stable_gateway_probe_cost();
+    test_link_down_while_retrying();
+    test_reconnect_backoff_after_retries_exhausted();
+    test_device_reconnects_when_ap_returns();
+    printf("ip_watchdog: all tests passed\n");
+    return 0;
+}
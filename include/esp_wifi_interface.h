@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include "esp_check.h"
 #include "esp_wifi.h"
+#include "esp_netif.h"
 #include "driver/gpio.h"
 #include "esp_nvs.h"
 
@@ -16,9 +17,74 @@ typedef struct {
     uint8_t esp_wifi_scan_auth_mode_treshold; // Authentication mode threshold for Wi-Fi scan
     gpio_num_t status_io;
     gpio_num_t reset_io;
-  
+    uint32_t ip_watchdog_interval_ms; // Gateway probe interval after a failure, 0 disables the IP watchdog
+    uint32_t ip_watchdog_max_interval_ms; // Probe interval ceiling reached while the gateway keeps answering
+    uint8_t ip_watchdog_max_failures; // Consecutive failed probes before re-DHCP, twice as many before reassociating
+    uint8_t ap_max_connection; // Maximum stations on the provisioning AP, 0 for the default of 4, capped at ESP_WIFI_MAX_CONN_NUM
+    uint32_t ap_idle_timeout_ms; // Disconnect stations that made no HTTP request after this time, 0 disables it
+
 } esp_wifi_interface_config_t;
 
+// Addresses of the interface, see WiFiGetLocalIPInfo
+typedef struct {
+    esp_netif_ip_info_t ip4; // IPv4 address, netmask and gateway, zero until assigned
+    esp_ip4_addr_t dns; // Main DNS server
+    esp_ip6_addr_t ip6_link_local; // IPv6 link-local address, zero if IPv6 is disabled
+    esp_ip6_addr_t ip6_global; // IPv6 SLAAC address, zero until a router advertisement is received
+    bool is_static; // IPv4 configured from NVS without DHCP
+} esp_wifi_interface_ip_t;
+
+// Connection phase reported by WiFiGetState
+typedef enum {
+    WIFI_STATE_IDLE = 0,     // WiFiSimpleConnection not called yet
+    WIFI_STATE_CONNECTING,   // STA started, looking for the AP
+    WIFI_STATE_ASSOCIATED,   // associated with the AP, waiting for an IP address
+    WIFI_STATE_GOT_IP,       // associated with an IP address
+    WIFI_STATE_DISCONNECTED, // association lost and retries exhausted
+    WIFI_STATE_PROVISIONING, // AP mode, waiting for credentials
+} esp_wifi_interface_phase_t;
+
+// Interface state snapshot, see WiFiGetState
+typedef struct {
+    wifi_mode_t mode; // WIFI_MODE_STA or WIFI_MODE_AP, WIFI_MODE_NULL before WiFiSimpleConnection
+    esp_wifi_interface_phase_t phase;
+    esp_ip4_addr_t ip; // IPv4 address, zero without IP
+    int8_t rssi; // RSSI of the AP, refreshed on association and on every IP watchdog probe
+    uint8_t bssid[6]; // BSSID of the AP
+    uint8_t channel; // primary channel of the AP
+    uint8_t retry_count; // connection attempts since the last IP
+    uint16_t last_disconnect_reason; // wifi_err_reason_t of the last disconnection, 0 if none
+} esp_wifi_interface_state_t;
+
+// Called after every state change from the event loop or IP watchdog task, must not block
+typedef void (*esp_wifi_interface_state_cb_t)(const esp_wifi_interface_state_t *state, void *arg);
+
+// Station associated with the provisioning AP, see WiFiGetAPStations
+typedef struct {
+    uint8_t mac[6];
+    uint16_t aid; // association id
+    esp_ip4_addr_t ip; // address leased by the AP DHCP server, zero until assigned
+    int8_t rssi;
+    int64_t connect_time_us; // esp_timer_get_time() at association
+    uint32_t bytes_rx; // HTTP request body bytes received from the station
+    uint32_t bytes_tx; // HTTP response bytes sent to the station
+    uint32_t requests; // HTTP requests served
+} esp_wifi_interface_ap_station_t;
+
+// Boot phases timestamped by the component (see WiFiGetBootPhaseTime)
+typedef enum {
+    WIFI_BOOT_PHASE_INIT = 0,    // WiFiInit entered
+    WIFI_BOOT_PHASE_GPIO,        // status and reset GPIOs configured
+    WIFI_BOOT_PHASE_NVS,         // NVS initialized and namespace opened
+    WIFI_BOOT_PHASE_CREDENTIALS, // SSID and password loaded
+    WIFI_BOOT_PHASE_NETIF,       // esp_netif and default event loop ready
+    WIFI_BOOT_PHASE_DRIVER,      // esp_wifi_init done
+    WIFI_BOOT_PHASE_START,       // esp_wifi_start returned
+    WIFI_BOOT_PHASE_CONNECTED,   // associated with the AP
+    WIFI_BOOT_PHASE_GOT_IP,      // IP address assigned
+    WIFI_BOOT_PHASE_MAX,
+} esp_wifi_interface_boot_phase_t;
+
 esp_err_t WiFiInit (esp_wifi_interface_config_t *config);
 
 void WiFiDeinit ();
@@ -27,8 +93,32 @@ void WiFiSimpleConnection();
 
 void esp_wifi_check_reset_button();
 
+// IPv4 address as a string, empty without IP. The string stays valid until the address changes
+// twice, copy it right away; WiFiGetState and WiFiGetLocalIPInfo return a consistent copy
 const char *WiFiGetLocalIP();
 
+esp_err_t WiFiGetLocalIPInfo(esp_wifi_interface_ip_t *ip);
+
+// Consistent copy of the interface state, lock-free and safe from any task or core
+void WiFiGetState(esp_wifi_interface_state_t *state);
+
+// Single word read, cheap enough to call before every publish
+bool WiFiIsConnected();
+
+// Register a state change callback, NULL to remove it
+void WiFiSetStateCallback(esp_wifi_interface_state_cb_t cb, void *arg);
+
+// Copy the provisioning AP station table. count holds the capacity of stations on input and the
+// number of stations copied on output
+esp_err_t WiFiGetAPStations(esp_wifi_interface_ap_station_t *stations, size_t *count);
+
+// Time in microseconds since boot when the phase was reached, 0 if not reached yet
+int64_t WiFiGetBootPhaseTime(esp_wifi_interface_boot_phase_t phase);
+
+// Log the time of every boot phase. Not called by the component, logging over the UART console
+// would slow down every deep-sleep wake
+void WiFiLogBootProfile();
+
 #endif
 
 
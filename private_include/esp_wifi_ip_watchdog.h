@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2025 Tulio Carvalho
+Licensed under the MIT License. See LICENSE file for details.
+*/
+
+#ifndef _esp_wifi_ip_watchdog_H_
+#define _esp_wifi_ip_watchdog_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Probe scheduling and recovery decisions of the IP watchdog. Kept free of ESP-IDF calls so it
+// can be built and tested on the host, ip_watchdog_task only performs the returned action.
+
+typedef enum {
+    IP_WATCHDOG_ACTION_NONE = 0,
+    IP_WATCHDOG_ACTION_REDHCP,      // restart the DHCP client
+    IP_WATCHDOG_ACTION_REASSOCIATE, // disconnect, the event_handler retry path reconnects
+    IP_WATCHDOG_ACTION_RECONNECT,   // retries exhausted, reset the retry count and connect again
+} ip_watchdog_action_t;
+
+typedef struct {
+    uint32_t min_interval_ms; // probe interval after a failure
+    uint32_t max_interval_ms; // probe interval ceiling while the gateway answers
+    uint8_t max_failures;     // failed probes before re-DHCP, twice as many before reassociating
+} ip_watchdog_config_t;
+
+typedef struct {
+    uint32_t interval_ms; // delay before the next probe
+    uint16_t failures;    // consecutive failed probes, wide enough for 2 * UINT8_MAX
+    uint32_t reconnect_backoff_ms; // wait before the next reconnect once retries are exhausted
+    bool reconnect_pending; // backoff started, reconnect on the next call if still exhausted
+} ip_watchdog_state_t;
+
+void ip_watchdog_reset(ip_watchdog_state_t *state, const ip_watchdog_config_t *config);
+
+// result of one gateway probe
+ip_watchdog_action_t ip_watchdog_on_probe(ip_watchdog_state_t *state, const ip_watchdog_config_t *config, bool reachable);
+
+// called instead of a probe while the STA is not associated, retries_exhausted once the event_handler
+// retry path gave up
+ip_watchdog_action_t ip_watchdog_on_link_down(ip_watchdog_state_t *state, const ip_watchdog_config_t *config, bool retries_exhausted);
+
+#endif